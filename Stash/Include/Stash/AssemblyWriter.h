@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Sequence.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+
+namespace Stash
+{
+	struct AssemblyWriterOptions
+	{
+		// Spans of sequences mapped from this assembly, if given, are passed through from its file.
+		const char* assemblyPath = nullptr;
+		// zstd level of the output, 0 writes it plain.
+		int compressionLevel = 0;
+		// Threads compressing the output in the background.
+		uint32_t threads = 1;
+		// Writes a samtools .fai index next to a plain output.
+		bool index = false;
+	};
+
+	// Writes the FASTA records of a cut output with vectored writes straight from the bases of the sequences, which
+	// are views of the mapped assembly for single-line records. Long spans of a mapped assembly are copied within the
+	// kernel with copy_file_range instead, so unchanged contigs never pass through user space. A compressed output is
+	// a zstd frame that is compressed by worker threads while the records are added.
+	class AssemblyWriter
+	{
+	public:
+		AssemblyWriter();
+		~AssemblyWriter();
+
+		bool open( const char* path, const AssemblyWriterOptions& options = AssemblyWriterOptions() );
+		// Ends the last record and writes everything left. Returns false if any write failed.
+		bool close();
+
+		// Adds the record of the bases of "sequence" from "begin" to "end". The bases must stay valid until the next
+		// flush.
+		void writeRecord( const char* id, const Sequence& sequence, uint64_t begin, uint64_t end );
+		bool flush();
+
+		uint64_t getPassthroughBytes() const { return m_passthroughBytes; }
+
+	private:
+		// Bases, or text of m_text if "data" is null.
+		struct Span
+		{
+			const char* data;
+			uint64_t offset;
+			uint64_t length;
+		};
+
+		void addText( const char* text, uint64_t length );
+		// Copies a span of the assembly file, and returns the number of bytes copied.
+		uint64_t passThrough( uint64_t offset, uint64_t length );
+		bool writeAll( const char* data, uint64_t length );
+		// Compresses "length" bytes, or ends the frame, and writes the compressed bytes that are ready.
+		bool compress( const char* data, uint64_t length, bool end );
+
+	private:
+		int m_file;
+		int m_assemblyFile;
+		bool m_first;
+		bool m_failed;
+
+		std::vector< Span > m_spans;
+		std::string m_text;
+		uint64_t m_pendingBytes;
+		uint64_t m_passthroughBytes;
+
+		ZSTD_CCtx_s* m_context;
+		std::vector< char > m_compressed;
+
+		FILE* m_indexFile;
+		// Length of the plain output so far.
+		uint64_t m_offset;
+	};
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Stash
+{
+	struct CutParameters;
+
+	// A run of consecutive positions [ start, end ) whose pooled signal is below the cut threshold.
+	struct LowRun
+	{
+		uint64_t start;
+		uint64_t end;
+		// Lowest pooled signal of the run.
+		uint8_t minimum;
+		// Index of the pooled signal of "start" in the low values of its pooling.
+		uint64_t firstValue;
+	};
+
+	// A chain of low signal positions [ chainStart, chainEnd ] that results in a single cut.
+	struct Breakpoint
+	{
+		uint64_t chainStart;
+		uint64_t chainEnd;
+		// Lowest pooled signal of the runs of the chain.
+		uint8_t minimum;
+	};
+
+	// Max pools the positions [ begin, end ) of a matches signal that is pushed one value at a time.
+	// Pooling uses a monotonic deque, so the signal never has to be stored.
+	class MaxPooling
+	{
+	public:
+		MaxPooling( const CutParameters& cutParameters, uint64_t signalLength, uint64_t begin, uint64_t end );
+
+		// The range of signal values that must be pushed, in order.
+		uint64_t getSignalBegin() const { return m_signalBegin; }
+		uint64_t getSignalEnd() const { return m_signalEnd; }
+
+		uint32_t getCutThreshold() const { return m_cutThreshold; }
+		uint32_t getMaxPoolingRadius() const { return m_maxPoolingRadius; }
+
+		// Appends signal[ index ]. Values outside of the signal range are ignored.
+		void push( uint64_t index, uint8_t value );
+
+		std::vector< LowRun >& getRuns() { return m_runs; }
+		// The pooled signal of every position of the runs, in order.
+		const std::vector< uint8_t >& getLowValues() const { return m_lowValues; }
+
+	private:
+		void evaluate( uint64_t position, uint32_t max );
+
+	private:
+		uint32_t m_cutThreshold;
+		uint32_t m_maxPoolingRadius;
+
+		uint64_t m_begin;
+		uint64_t m_end;
+		uint64_t m_signalBegin;
+		uint64_t m_signalEnd;
+
+		// Ring buffer holding the deque of ( index, value ) pairs with decreasing values.
+		std::vector< uint64_t > m_indices;
+		std::vector< uint8_t > m_values;
+		uint64_t m_mask;
+		uint64_t m_head;
+		uint64_t m_tail;
+
+		std::vector< LowRun > m_runs;
+		std::vector< uint8_t > m_lowValues;
+	};
+
+	// Chains the low runs of a whole signal, in order, into breakpoints.
+	class CutChain
+	{
+	public:
+		CutChain( const CutParameters& cutParameters );
+
+		// "values" holds the pooled signal of every position of the run.
+		void add( const LowRun& run, const uint8_t* values );
+		// Closes the last chain. Call once all runs are added.
+		void finish();
+
+		const std::vector< Breakpoint >& getBreakpoints() const { return m_breakpoints; }
+
+	private:
+		void evaluate( uint64_t position, uint8_t minimum );
+
+	private:
+		uint32_t m_minCutDistance;
+
+		uint64_t m_lastCutPosition;
+		uint64_t m_chainStart;
+		uint8_t m_chainMinimum;
+		std::vector< Breakpoint > m_breakpoints;
+	};
+}
@@ -12,6 +12,10 @@ namespace btllib
 
 namespace Stash
 {
+	class MappedFastaReader;
+
+	// Reads plain FASTA and FASTQ files with a MappedFastaReader, and any other input with btllib. Sequences
+	// of a mapped file refer to its bases, and stay valid after the reader is closed.
 	class ScopedFastaReader
 	{
 	public:
@@ -21,14 +25,22 @@ namespace Stash
 		ScopedFastaReader();
 		~ScopedFastaReader();
 
-		bool open( const char* path );
+		// Mapped files are parsed on "threads" threads. A path of "-" reads stdin.
+		bool open( const char* path, uint32_t threads = 1 );
 		void close();
 
 		uint32_t loadReads( uint32_t numberToRead, std::vector< std::unique_ptr< Read > >& reads, uint64_t minLength = 0 );
-		uint32_t loadSequences( uint32_t numberToRead, std::vector< std::unique_ptr< Sequence > >& sequences, uint64_t minLength = 0 );
+		// Stops early once the loaded sequences reach "maxBases" bases.
+		uint32_t loadSequences( uint32_t numberToRead, std::vector< std::unique_ptr< Sequence > >& sequences, uint64_t minLength = 0, uint64_t maxBases = ~0ull );
+
+	private:
+		// Returns the next record, whose bases are mapped if "mapped" is set and valid until the next call otherwise.
+		bool next( SequenceView& record, bool& mapped );
 
 	private:
 		std::unique_ptr<btllib::SeqReader> m_reader;
+		std::unique_ptr<MappedFastaReader> m_mappedReader;
+		std::string m_bases;
 	};
 }
 
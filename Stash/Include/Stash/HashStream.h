@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Sequence.h"
+#include <btllib/nthash.hpp>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Stash
+{
+	// Streams of hashed reads, which fill inserts without parsing or hashing any sequence. A stream starts with
+	// the magic "STASHHSH", its version, the spaced seed length, the spaced seed count and the spaced seeds.
+	// Every read follows as 64-bit words: the two read ID hashes, the read length, the number of k-mers, and
+	// the spaced seed hashes of every k-mer, one per seed.
+	namespace HashStream
+	{
+		constexpr uint32_t VERSION = 1;
+		// Words before the k-mer hashes of a read.
+		constexpr uint64_t READ_HEADER_WORDS = 4;
+	}
+
+	class HashStreamWriter
+	{
+	public:
+		HashStreamWriter();
+		~HashStreamWriter();
+
+		// Writes the header of a stream for the given spaced seeds. A path of "-" writes stdout.
+		bool open( const char* path, const std::vector< std::string >& spacedSeeds );
+		bool close();
+
+		// Writes a read given its read ID hashes and the spaced seed hashes of its k-mers.
+		bool write( uint64_t hash1, uint64_t hash2, uint64_t length, const uint64_t* hashes, uint64_t kmers );
+		// Hashes a read the way fill does and writes it, unless it is too short to be filled.
+		bool write( const Read& read );
+
+	private:
+		FILE* m_file;
+		uint32_t m_spacedSeedLength;
+		std::vector< btllib::hashing_internals::SpacedSeed > m_ntSeeds;
+		std::vector< uint64_t > m_hashes;
+	};
+
+	class HashStreamReader
+	{
+	public:
+		HashStreamReader();
+		~HashStreamReader();
+
+		// Reads the header of a stream. A path of "-" reads stdin.
+		bool open( const char* path );
+		void close();
+
+		const std::vector< std::string >& getSpacedSeeds() const { return m_spacedSeeds; }
+
+		// Appends up to "maxReads" reads to "records" as they are in the stream, and returns their number.
+		uint32_t loadReads( uint32_t maxReads, std::vector< uint64_t >& records );
+		// Whether the stream ended in the middle of a read.
+		bool isTruncated() const { return m_truncated; }
+
+	private:
+		FILE* m_file;
+		std::vector< std::string > m_spacedSeeds;
+		bool m_truncated;
+	};
+}
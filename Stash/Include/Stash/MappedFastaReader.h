@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Sequence.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Stash
+{
+	// Reads an uncompressed FASTA or FASTQ file through a read-only mapping. The file is split into chunks at
+	// record boundaries, and a round of chunks is parsed on all threads whenever the previous round is used up.
+	// Single-line records are views of the mapping, and the lines of multi-line records are joined in a buffer.
+	class MappedFastaReader
+	{
+	public:
+		MappedFastaReader();
+		~MappedFastaReader();
+
+		// Returns false if the file is not a regular file that starts with a FASTA record or a four-line FASTQ record.
+		bool open( const char* path, uint32_t threads );
+		void close();
+
+		// Returns the next record, whose bases are in the mapping if "mapped" is set, or in a buffer that is
+		// valid until the next call otherwise.
+		bool next( SequenceView& record, bool& mapped );
+
+		// The mapping of the file, which keeps it mapped for the sequences that refer to it.
+		const std::shared_ptr< const char >& getMapping() const { return m_mapping; }
+
+	private:
+		struct Chunk
+		{
+			std::vector< SequenceView > records;
+			// Whether the bases of each record are joined in "bases" instead of mapped.
+			std::vector< uint8_t > joined;
+			std::string bases;
+			// Offset of the first invalid record, if any.
+			uint64_t invalidOffset;
+		};
+
+		// Whether the record at "first" is a FASTA record, or a FASTQ record of four lines.
+		bool isValidFirstRecord( uint64_t first ) const;
+		// Finds the first record that starts at or after "offset".
+		uint64_t findRecordStart( uint64_t offset ) const;
+		void parseChunk( uint64_t begin, uint64_t end, Chunk& chunk ) const;
+		// Parses the next round of chunks on all threads and releases the pages of the previous one.
+		bool parseRound();
+
+	private:
+		std::string m_path;
+		std::shared_ptr< const char > m_mapping;
+		uint64_t m_length;
+		bool m_fastq;
+		uint32_t m_threads;
+
+		// Offsets of the chunks, from 0 to the length of the file.
+		std::vector< uint64_t > m_boundaries;
+		size_t m_nextChunk;
+
+		std::vector< Chunk > m_round;
+		size_t m_roundChunk;
+		size_t m_roundRecord;
+		// The pages before this offset are released.
+		uint64_t m_releasedOffset;
+	};
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Stash
+{
+	// Runs weighted tasks, e.g. weighted by the number of bases they process, on a fixed number of threads.
+	// Tasks are assigned longest first to the least loaded thread (LPT), and threads that run out of
+	// work steal the smallest remaining tasks of the most loaded thread.
+	class TaskScheduler
+	{
+	public:
+		TaskScheduler( uint32_t threads );
+		~TaskScheduler();
+
+		// Queues a task and returns its index.
+		size_t add( uint64_t weight );
+		size_t size() const { return m_weights.size(); }
+
+		// Runs every queued task as "function( task, thread )" and clears the queue.
+		void run( const std::function< void( size_t, uint32_t ) >& function );
+
+		// Logs the busy and idle time of each thread, accumulated over every run.
+		void report( const char* stage ) const;
+
+	private:
+		bool pop( uint32_t thread, size_t& task );
+		bool steal( uint32_t thread, size_t& task );
+
+	private:
+		struct Queue;
+
+		uint32_t m_threads;
+		std::vector< uint64_t > m_weights;
+		std::vector< std::unique_ptr< Queue > > m_queues;
+
+		std::vector< double > m_busySeconds;
+		double m_wallSeconds;
+		std::vector< uint64_t > m_tasksRun;
+		std::vector< uint64_t > m_tasksStolen;
+	};
+
+	// Hands out results in input order, each one as soon as it and every result before it are final.
+	class ReorderBuffer
+	{
+	public:
+		// "write( index )" is called in order of index, never concurrently.
+		ReorderBuffer( const std::function< void( size_t ) >& write );
+
+		// Starts a new set of "count" results.
+		void reset( size_t count );
+		// Marks a result as final and writes every result that is now in order.
+		void complete( size_t index );
+
+	private:
+		std::function< void( size_t ) > m_write;
+		std::mutex m_mutex;
+		std::vector< bool > m_final;
+		size_t m_next;
+	};
+}
@@ -1,31 +1,36 @@
 #pragma once
 
+#include <memory>
 #include <string>
 
 namespace Stash
 {
-	struct Sequence
+	struct SequenceView
 	{
-		Sequence( const std::string& id, const char* sequence, uint64_t length );
-		~Sequence();
+		SequenceView( const std::string& id, const char* sequence, uint64_t length );
 
 		std::string m_id;
-		char* m_sequence;
+		const char* m_sequence;
 		uint64_t m_length;
 	};
 
-	struct SequenceView
+	struct Sequence
 	{
-		SequenceView( const std::string& id, const char* sequence, uint64_t length );
+		Sequence( const std::string& id, const char* sequence, uint64_t length );
+		// Refers to the bases of a mapped file instead of copying them, and keeps the file mapped.
+		Sequence( const SequenceView& view, const std::shared_ptr< const char >& mapping );
+		~Sequence();
 
 		std::string m_id;
-		const char* m_sequence;
+		char* m_sequence;
 		uint64_t m_length;
+		std::shared_ptr< const char > m_mapping;
 	};
 
 	struct Read : public Sequence
 	{
 		Read( const std::string& id, const char* sequence, uint64_t length );
+		Read( const SequenceView& view, const std::shared_ptr< const char >& mapping );
 
 		uint64_t m_hash1;
 		uint64_t m_hash2;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Sequence.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Stash
+{
+	struct WindowParameters;
+
+	// Stores the matches signal of each contig in a directory, so later cuts of the same contig
+	// against the same Stash and window parameters skip hashing and gathers.
+	// Each contig is a file named after a hash of its sequence, the Stash fingerprint and the window parameters.
+	class SignalCache
+	{
+	public:
+		SignalCache( const std::string& directory, uint64_t stashFingerprint, const WindowParameters& windowParameters, uint32_t spacedSeedLength );
+
+		// Creates the cache directory if needed.
+		bool open();
+
+		// Loads the signal of a sequence. Fails if the cache has no signal of the given length for it.
+		bool load( const Sequence& sequence, uint64_t signalLength, std::vector< uint8_t >& signal ) const;
+		bool store( const Sequence& sequence, const std::vector< uint8_t >& signal ) const;
+
+	private:
+		std::string getPath( const Sequence& sequence ) const;
+
+	private:
+		std::string m_directory;
+		uint64_t m_stashFingerprint;
+		uint64_t m_parametersHash;
+	};
+}
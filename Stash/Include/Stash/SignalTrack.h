@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Stash
+{
+	// Writes the matches signal of the contigs of a cut, one contig at a time, as a bedGraph and as a binary track.
+	// The signal is binned by the minimum or the mean of every "binSize" positions, and runs of equal bins are merged
+	// in the bedGraph.
+	//
+	// The binary track starts with the magic "STASHSIG", its version, the bin size, whether bins are means, and the
+	// size of a value: 1 byte for minimums, or a 4-byte float for means. The values of every contig follow one after
+	// another, and an index closes the file. Each index entry is the length of the contig name, the name, the contig
+	// coordinate of the first bin, the number of bins and the file offset of the bins, all 64-bit but the name length,
+	// which is 32-bit. The file ends with the offset of the index, its number of entries and the magic "STASHIDX".
+	class SignalTrack
+	{
+	public:
+		// Writes "<pathPrefix>.bedGraph" and "<pathPrefix>.sigtrack".
+		SignalTrack( const std::string& pathPrefix, uint32_t binSize, bool mean );
+		~SignalTrack();
+
+		bool open();
+		// Writes the index. Returns false if any write failed.
+		bool close();
+
+		// Writes the signal of a contig, whose first value is at position "start" of the contig.
+		void write( const std::string& contig, uint64_t start, const std::vector< uint8_t >& signal );
+
+	private:
+		struct IndexEntry
+		{
+			std::string contig;
+			uint64_t start;
+			uint64_t bins;
+			uint64_t offset;
+		};
+
+	private:
+		std::string m_pathPrefix;
+		uint32_t m_binSize;
+		bool m_mean;
+
+		FILE* m_bedGraph;
+		FILE* m_track;
+		uint64_t m_offset;
+		std::vector< IndexEntry > m_index;
+
+		std::vector< uint8_t > m_minimums;
+		std::vector< float > m_means;
+	};
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace Stash
+{
+	// A frozen, read-only table of 64-bit rows that only stores its non-zero rows.
+	// A rank bitvector marks the non-zero rows, in cache lines holding the rank of their first row and
+	// LINE_ROWS bits, so that finding a row reads a single line before the row itself.
+	class SparseTable
+	{
+	public:
+		static constexpr uint64_t LINE_ROWS = 448;
+		static constexpr uint64_t LINE_WORDS = 8;
+		static constexpr uint64_t NO_RANK = ~0ull;
+
+		// Freezes the rows of a dense table on the given number of threads.
+		void build( const uint64_t* rows, uint64_t rowCount, uint32_t threads );
+
+		bool read( FILE* file, uint64_t rowCount );
+		bool write( FILE* file ) const;
+
+		// The index of a row among the non-zero rows, or NO_RANK if the row is zero.
+		uint64_t getRank( uint64_t row ) const
+		{
+			const uint64_t* line = getLine( row );
+			uint64_t offset = row % LINE_ROWS;
+			uint64_t word = offset >> 6;
+			uint64_t bits = line[ 1 + word ];
+
+			if ( !( ( bits >> ( offset & 63 ) ) & 1 ) )
+				return NO_RANK;
+
+			uint64_t rank = line[ 0 ];
+			for ( uint64_t i = 0; i < word; i++ )
+				rank += __builtin_popcountll( line[ 1 + i ] );
+
+			return rank + __builtin_popcountll( bits & ( ( 1ull << ( offset & 63 ) ) - 1 ) );
+		}
+
+		uint64_t getRow( uint64_t row ) const
+		{
+			uint64_t rank = getRank( row );
+			return rank == NO_RANK ? 0 : m_values[ rank ];
+		}
+
+		const uint64_t* getLine( uint64_t row ) const { return m_index.data() + row / LINE_ROWS * LINE_WORDS; }
+		const uint64_t* getValues() const { return m_values.data(); }
+
+		// Decodes the rows [ first, first + count ).
+		void copyRows( uint64_t first, uint64_t count, uint64_t* destination ) const;
+
+		uint64_t getNonZeroRows() const { return m_values.size(); }
+		uint64_t getBytes() const { return ( m_index.size() + m_values.size() ) * sizeof( uint64_t ); }
+
+	private:
+		std::vector< uint64_t > m_index;
+		std::vector< uint64_t > m_values;
+	};
+}
@@ -1,14 +1,26 @@
 #pragma once
 
 #include "Sequence.h"
+#include "SparseTable.h"
 #include <btllib/nthash.hpp>
 
+#include <algorithm>
+#include <vector>
+
 #define STASH_VERSION "1.2.0"
 
 namespace Stash
 {
 	struct WindowParameters;
 	struct CutParameters;
+	struct CutOptions;
+	struct FillOptions;
+	struct LoadOptions;
+	struct SaveOptions;
+	struct CutGeometry;
+	struct CutSegment;
+	struct ThreadData_Cut;
+	struct FillProgress;
 
 	namespace Consts
 	{
@@ -19,34 +31,163 @@ namespace Stash
 		constexpr uint32_t SPACED_SEED_COUNT = 4;
 		constexpr uint64_t MAX_T1 = (1 << T1) - 1;
 		constexpr uint64_t MAX_T2 = (1 << T2) - 1;
+		constexpr uint32_t MAX_SPACED_SEED_LENGTH = 1024;
 		constexpr uint32_t B1 = T1 * READ_ID_TILES;
 		constexpr uint32_t B2 = T2 * READ_ID_TILES;
+
+		// StashCut splits longer contigs into segments of this many positions.
+		constexpr uint64_t CUT_SEGMENT_LENGTH = 1ull << 21;
+
+		// Stash file formats. Version 0 files have no padding before the table, version 1 files have a raw
+		// table at an aligned offset, version 2 files have a table of independently compressed blocks, and
+		// version 3 files have a sparse table.
+		constexpr int RAW_FORMAT_VERSION = 1;
+		constexpr int COMPRESSED_FORMAT_VERSION = 2;
+		constexpr int SPARSE_FORMAT_VERSION = 3;
+		constexpr uint64_t COMPRESSED_BLOCK_ROWS = 1ull << 20;
+		// Version of a shared Stash whose table is not complete yet.
+		constexpr int PUBLISHING_VERSION = -1;
+		constexpr uint64_t TABLE_ALIGNMENT = 4096;
+		// The header of a Stash file holds a checksum of every block of this many rows.
+		constexpr uint64_t CHECKSUM_BLOCK_ROWS = 1ull << 20;
 	}
 
+	// Statistics of the fills of a Stash, kept in its file.
+	struct FillStatistics
+	{
+		uint64_t reads = 0;
+		uint64_t bases = 0;
+		uint64_t kmers = 0;
+	};
+
+	// Where the table of a Stash lives, which decides how it is released.
+	enum class MemorySource
+	{
+		Heap,
+		Mapped,
+		// Anonymous zero pages, mapped lazily on first touch.
+		Anonymous,
+		// The rows are frozen in a SparseTable, and there is no dense table.
+		Sparse,
+	};
+
 	class Stash
 	{
 	public:
 		// Creates the Stash with "2 ^ logRows" rows.
 		Stash( uint32_t logRows, const std::vector< std::string >& spacedSeeds );
 		// Loads Stash from a given path.
-		Stash( const char* stashPath );
+		Stash( const char* stashPath, const LoadOptions& options );
 		~Stash();
 
-		// Populates the Stash given a set of reads.
+		// Populates the Stash given a set of reads. A path of "-" reads stdin.
 		bool fill( const char* readsPath, const uint32_t threads );
+		// Reads every input, e.g. a named pipe, on a thread of its own while the reads are inserted. Hash streams
+		// hold reads that are hashed already, see HashStream.h.
+		bool fill( const std::vector< std::string >& readsPaths, const std::vector< std::string >& hashStreamPaths, const uint32_t threads );
 		void fill( std::vector< std::unique_ptr< Read > >& reads, const uint32_t threads );
+		// Fills a new Stash with one pass over the reads per partition of its rows, saving every partition raw
+		// to "outputPath" and releasing it, so that only one partition is in memory at a time. Reads that
+		// cannot be read again, from stdin or a pipe, need a read cache.
+		bool fill( const char* readsPath, const char* outputPath, const uint32_t threads, const FillOptions& options );
 
 		// Performs StashCut to correct misassemblies of a given assembly.
-		bool cut( const char* assemblyPath, const char* outputPath, const WindowParameters& windowParameters, const CutParameters& cutParameters, const uint32_t threads ) const;
+		bool cut( const char* assemblyPath, const char* outputPath, const WindowParameters& windowParameters, const CutParameters& cutParameters, const uint32_t threads, const CutOptions& options ) const;
+		// Sweeps several sets of cut parameters over a single signal computation, writing one output per set.
+		bool cut( const char* assemblyPath, const char* outputPath, const WindowParameters& windowParameters, const std::vector< CutParameters >& cutParameters, const uint32_t threads, const CutOptions& options ) const;
 
 		// Stores a Stash in the given path.
 		bool save( const char* outputPath );
+		bool save( const char* outputPath, const SaveOptions& options );
+
+		// Copies the Stash into a named POSIX shared memory segment, which cut can attach to read-only.
+		bool publish( const char* name, const uint32_t threads );
+		// Removes a shared Stash. Processes that are attached to it keep it until they detach.
+		static bool unpublish( const char* name );
+
+		// Hashes the seeds, the geometry and the whole table of the Stash.
+		uint64_t getFingerprint( const uint32_t threads ) const;
+
+		// Checks the table against the block checksums of its file on all threads.
+		bool verify( const uint32_t threads ) const;
+
+		// Touches every page of the table on all threads, instead of on first use.
+		void prefault( const uint32_t threads );
+
+		// Replaces the table by a read-only sparse table, which is smaller when few rows are used.
+		void freeze( const uint32_t threads );
 
 	private:
 		void initialize();
 
+		// Releases the dense table.
+		void releaseMemory();
+
+		// Row accessors that work on both the dense and the sparse table.
+		void prefetchRow( uint64_t row ) const { __builtin_prefetch( m_memorySource == MemorySource::Sparse ? m_sparse.getLine( row ) : m_memory + row ); }
+		// Replaces each row index by its row.
+		void gatherRows( uint64_t* rows, uint64_t count ) const;
+		void copyRows( uint64_t first, uint64_t count, uint64_t* destination ) const;
+		// Returns the rows [ first, first + count ), decoded into "buffer" if they are not stored densely.
+		const uint64_t* readRows( uint64_t first, uint64_t count, std::vector< uint64_t >& buffer ) const;
+
+		// Maps the table of an open Stash file read-only.
+		void mapTable( int fileDescriptor, const char* stashPath, uint64_t tableOffset, const LoadOptions& options );
+
+		// The header of a Stash file with the given table format, padded up to the table.
+		std::string buildHeader( int version ) const;
+		// Writes the header of a Stash file and returns its length, or 0 on failure.
+		uint64_t writeHeader( FILE* file, int version ) const;
+		// Reads the header of either format, exiting if it is invalid.
+		void readHeader( FILE* file, const char* source, int& version, uint64_t& tableOffset );
+
+		// Hashes the table in blocks of CHECKSUM_BLOCK_ROWS rows on all threads, and counts the used rows.
+		void computeChecksums( const uint32_t threads, std::vector< uint64_t >& checksums, uint64_t& usedRows ) const;
+		void computeChecksums( const uint32_t threads, uint64_t firstBlock, uint64_t blocks, uint64_t* checksums, uint64_t& usedRows ) const;
+		// Computes the checksums unless they still match the table.
+		void updateChecksums( const uint32_t threads );
+
+		// Reads or writes a raw table at its offset on all threads.
+		bool readTable( const char* stashPath, int fileDescriptor, uint64_t tableOffset, const LoadOptions& options );
+		bool writeTable( const char* outputPath, int fileDescriptor, uint64_t tableOffset, const SaveOptions& options ) const;
+
+		// Compresses or decompresses the blocks of the table on all threads.
+		bool writeCompressedTable( FILE* file, const SaveOptions& options ) const;
+		bool readCompressedTable( FILE* file, uint64_t tableOffset, uint32_t threads );
+
+		// Inserts the k-mers of a read, using "readIdTiles" as scratch memory. Only the rows
+		// [ firstRow, firstRow + partitionRows ) are updated.
+		void insertRead( const Read& read, uint8_t* readIdTiles, FillStatistics& statistics, uint64_t firstRow = 0, uint64_t partitionRows = ~0ull );
+		// Inserts a k-mer given the hashes of its spaced seeds.
+		void insertKmer( const uint64_t* hashes, const uint8_t* readIdTiles, uint64_t firstRow, uint64_t partitionRows );
+		// Appends the record of a read to "records": its read ID tiles, then its length, its number of k-mers and
+		// their hashes as in a hash stream.
+		void hashRead( const Read& read, std::vector< uint64_t >& records, FillStatistics& statistics ) const;
+		void insertRecords( const uint64_t* records, uint64_t length, uint64_t firstRow, uint64_t partitionRows );
+		// Fills the rows of a partition from the reads, or from the hashed reads of "cacheInput". The hashed
+		// reads are appended to "cacheOutput" if there is one.
+		bool fillPartition( const char* readsPath, uint64_t firstRow, uint64_t partitionRows, FILE* cacheInput, FILE* cacheOutput, const uint32_t threads, FillProgress& progress );
+
+		// Computes the matches signal of a segment of a sequence and pushes it to the segment's poolings.
+		// Returns the number of positions whose matches were counted.
+		uint64_t computeSignal( const Sequence& sequence, const CutGeometry& geometry, ThreadData_Cut& threadData, CutSegment& segment ) const;
+		// Pushes the signal of the chunk positions [ firstPosition, lastPosition ), counting the matches of
+		// a coarse grid first and then only of the positions whose pooled signal may be below a threshold.
+		uint64_t evaluateCoarseToFine( const CutGeometry& geometry, ThreadData_Cut& threadData, CutSegment& segment, uint64_t firstPosition, uint64_t lastPosition ) const;
+		// Reads the Stash rows of the frames compared by the given chunk positions, where not read yet.
+		void loadFrames( const CutGeometry& geometry, ThreadData_Cut& threadData, const std::vector< uint64_t >& positions ) const;
+
 	private:
 		uint64_t* m_memory;
+		MemorySource m_memorySource;
+		void* m_mapping;
+		size_t m_mappingLength;
+		SparseTable m_sparse;
+
+		FillStatistics m_fillStatistics;
+		uint64_t m_usedRows;
+		// Checksums of the blocks of the table, empty when they are unknown or stale.
+		std::vector< uint64_t > m_checksums;
 		
 		uint64_t m_rows;
 		uint64_t m_lastRow;
@@ -61,9 +202,11 @@ namespace Stash
 	{
 		uint32_t numberOfFrames;
 		uint32_t stride;
-		uint32_t delta;
+		// Distances between the compared windows. Several deltas give a multi-scale signal computed in one pass.
+		std::vector< uint32_t > deltas;
 
 		uint32_t GetWindowSize( uint32_t spacedSeedLength ) const { return ( numberOfFrames - 1 ) * stride + spacedSeedLength; }
+		uint32_t GetMaxDelta() const { return deltas.empty() ? 0 : *std::max_element( deltas.begin(), deltas.end() ); }
 	};
 
 	// StashCut Parameters
@@ -73,4 +216,92 @@ namespace Stash
 		uint32_t maxPoolingRadius;
 		uint32_t minCutDistance;
 	};
+
+	// Stash Out-of-Core Fill Options
+	struct FillOptions
+	{
+		// Number of passes over the reads, each of which fills its own range of rows. Partitions are
+		// rounded to whole checksum blocks.
+		uint32_t partitions = 1;
+		// File that keeps the hashed reads of the first pass, so that later passes neither parse nor hash
+		// them again. It takes 32 bytes per k-mer and is removed once the fill is done.
+		std::string readCachePath;
+		// Writes the partitions with O_DIRECT, bypassing the page cache.
+		bool directIO = false;
+	};
+
+	// Stash Loading Options
+	// When loading checks a table against the checksums of its file.
+	enum class Verification
+	{
+		// Tables that are read into memory are checked. Mapped files and shared attaches are not, as checking
+		// would touch every page of them before cut starts. pin checks the Stash it publishes.
+		Default,
+		Always,
+		Never
+	};
+
+	struct LoadOptions
+	{
+		// Maps the table read-only instead of reading it, so that startup is immediate and processes share
+		// the page cache. A mapped Stash can only be cut.
+		bool mapped = false;
+		// Touches every page of a mapped table on all threads before cut starts.
+		bool prefault = false;
+		uint32_t threads = 1;
+		// Attaches to a Stash published in shared memory under this name, instead of loading a file.
+		std::string sharedMemoryName;
+		// Freezes the loaded table into a sparse table.
+		bool sparse = false;
+		// Reads a raw table with O_DIRECT, bypassing the page cache.
+		bool directIO = false;
+		Verification verify = Verification::Default;
+	};
+
+	// Stash Saving Options
+	struct SaveOptions
+	{
+		// zstd level of the table blocks, or 0 to store the table raw so that it can be mapped.
+		int compressionLevel = 0;
+		// Saves the table sparse, which takes precedence over compression.
+		bool sparse = false;
+		// Writes a raw table with O_DIRECT, bypassing the page cache.
+		bool directIO = false;
+		uint32_t threads = 1;
+	};
+
+	// StashCut Options
+	// Output of cut: the cut assembly, or only where it is cut.
+	enum class CutFormat
+	{
+		Fasta,
+		// The chain of every breakpoint, with the cut position and the lowest pooled signal.
+		Bed,
+		// The pieces of the cut assembly as components of the input contigs.
+		Agp,
+		// Every breakpoint with its position, lowest pooled signal and chain.
+		Tsv
+	};
+
+	struct CutOptions
+	{
+		// Max number of assembly bases loaded at once, besides the sequence that crosses the limit.
+		uint64_t bufferBases = 1ull << 30;
+		// Directory of the signal cache. Empty disables the cache.
+		std::string signalCachePath;
+		// Distance between the positions of the coarse signal pass, 0 or 1 evaluates every position.
+		uint32_t coarseStep = 0;
+		CutFormat format = CutFormat::Fasta;
+		// zstd level of a FASTA output, 0 writes it plain.
+		int compressionLevel = 0;
+		// Writes a .fai index next to a plain FASTA output.
+		bool index = false;
+		// Path prefix of the exported matches signal, see SignalTrack. Empty exports nothing.
+		std::string signalTrackPath;
+		// Positions per exported value, binned by their minimum, or by their mean if "signalBinMean" is set.
+		uint32_t signalBinSize = 1;
+		bool signalBinMean = false;
+		// BED file of the regions to compute the signal and cut in. Empty cuts everywhere.
+		std::string regionsPath;
+	};
 }
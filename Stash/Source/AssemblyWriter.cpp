@@ -0,0 +1,296 @@
+#include "Stash/AssemblyWriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "Log.h"
+
+namespace Stash
+{
+	// Shorter spans are cheaper to gather into a vectored write than to copy with a system call of their own.
+	static const uint64_t s_minPassthroughLength = 1ull << 20;
+
+	// Pending records are written once they reach this length, so that writing overlaps with cutting.
+	static const uint64_t s_flushLength = 1ull << 24;
+
+	AssemblyWriter::AssemblyWriter()
+		: m_file( -1 )
+		, m_assemblyFile( -1 )
+		, m_first( true )
+		, m_failed( false )
+		, m_pendingBytes( 0 )
+		, m_passthroughBytes( 0 )
+		, m_context( nullptr )
+		, m_indexFile( nullptr )
+		, m_offset( 0 )
+	{
+	}
+
+	AssemblyWriter::~AssemblyWriter()
+	{
+		close();
+	}
+
+	bool AssemblyWriter::open( const char* path, const AssemblyWriterOptions& options )
+	{
+		close();
+
+		m_file = ::open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+		if ( m_file < 0 )
+			return false;
+
+		if ( options.index )
+		{
+			std::string indexPath = std::string( path ) + ".fai";
+			m_indexFile = fopen( indexPath.c_str(), "w" );
+			if ( m_indexFile == nullptr )
+			{
+				STASH_LOG_ERROR_PARAMS( "Failed to open index file: %s", indexPath.c_str() );
+				::close( m_file );
+				m_file = -1;
+				return false;
+			}
+		}
+
+		// Compressed outputs cannot take spans of the assembly file.
+		if ( options.compressionLevel > 0 )
+		{
+			m_context = ZSTD_createCCtx();
+			ZSTD_CCtx_setParameter( m_context, ZSTD_c_compressionLevel, options.compressionLevel );
+			// Libraries without multithreading reject workers, and compress on the calling thread.
+			if ( options.threads > 1 )
+				ZSTD_CCtx_setParameter( m_context, ZSTD_c_nbWorkers, ( int ) options.threads );
+
+			m_compressed.resize( ZSTD_CStreamOutSize() );
+		}
+		else if ( options.assemblyPath != nullptr )
+			m_assemblyFile = ::open( options.assemblyPath, O_RDONLY );
+
+		m_first = true;
+		m_failed = false;
+		m_pendingBytes = 0;
+		m_passthroughBytes = 0;
+		m_offset = 0;
+		return true;
+	}
+
+	bool AssemblyWriter::close()
+	{
+		if ( m_file < 0 )
+			return true;
+
+		addText( "\n", 1 );
+		bool written = flush() && ( m_context == nullptr || compress( nullptr, 0, true ) ) && !m_failed;
+		written = ::close( m_file ) == 0 && written;
+		m_file = -1;
+
+		if ( m_assemblyFile >= 0 )
+			::close( m_assemblyFile );
+		m_assemblyFile = -1;
+
+		if ( m_context != nullptr )
+			ZSTD_freeCCtx( m_context );
+		m_context = nullptr;
+
+		if ( m_indexFile != nullptr )
+		{
+			bool failed = ferror( m_indexFile ) != 0;
+			written = fclose( m_indexFile ) == 0 && !failed && written;
+		}
+		m_indexFile = nullptr;
+
+		return written;
+	}
+
+	void AssemblyWriter::addText( const char* text, uint64_t length )
+	{
+		// Consecutive text is written as a single span.
+		if ( !m_spans.empty() && m_spans.back().data == nullptr )
+			m_spans.back().length += length;
+		else
+			m_spans.push_back( { nullptr, m_text.size(), length } );
+
+		m_text.append( text, length );
+		m_pendingBytes += length;
+		m_offset += length;
+	}
+
+	void AssemblyWriter::writeRecord( const char* id, const Sequence& sequence, uint64_t begin, uint64_t end )
+	{
+		if ( m_first )
+		{
+			m_first = false;
+			addText( ">", 1 );
+		}
+		else
+			addText( "\n>", 2 );
+
+		addText( id, strlen( id ) );
+		addText( "\n", 1 );
+
+		const char* bases = sequence.m_sequence + begin;
+		uint64_t length = end - begin;
+
+		// Every record is a single line, and the index names it by the first word of its header.
+		if ( m_indexFile != nullptr )
+		{
+			int nameLength = ( int ) strcspn( id, " \t" );
+			fprintf( m_indexFile, "%.*s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", nameLength, id, length, m_offset, length, length + 1 );
+		}
+		m_offset += length;
+
+		if ( m_assemblyFile >= 0 && sequence.m_mapping && length >= s_minPassthroughLength )
+		{
+			uint64_t copied = flush() ? passThrough( bases - sequence.m_mapping.get(), length ) : 0;
+			bases += copied;
+			length -= copied;
+		}
+
+		if ( length > 0 )
+		{
+			m_spans.push_back( { bases, 0, length } );
+			m_pendingBytes += length;
+		}
+
+		if ( m_spans.size() >= IOV_MAX || m_pendingBytes >= s_flushLength )
+			flush();
+	}
+
+	uint64_t AssemblyWriter::passThrough( uint64_t offset, uint64_t length )
+	{
+		loff_t inputOffset = ( loff_t ) offset;
+		uint64_t copied = 0;
+		while ( copied < length )
+		{
+			ssize_t count = copy_file_range( m_assemblyFile, &inputOffset, m_file, nullptr, length - copied, 0 );
+			if ( count < 0 && errno == EINTR )
+				continue;
+
+			// Some file systems and older kernels cannot copy between the files, which the caller then writes instead.
+			if ( count <= 0 )
+			{
+				::close( m_assemblyFile );
+				m_assemblyFile = -1;
+				break;
+			}
+
+			copied += ( uint64_t ) count;
+		}
+
+		m_passthroughBytes += copied;
+		return copied;
+	}
+
+	bool AssemblyWriter::writeAll( const char* data, uint64_t length )
+	{
+		while ( length > 0 && !m_failed )
+		{
+			ssize_t written = write( m_file, data, length );
+			if ( written < 0 )
+			{
+				if ( errno == EINTR )
+					continue;
+
+				STASH_LOG_ERROR_PARAMS( "Failed to write cut output: %s", strerror( errno ) );
+				m_failed = true;
+				break;
+			}
+
+			data += written;
+			length -= written;
+		}
+
+		return !m_failed;
+	}
+
+	bool AssemblyWriter::compress( const char* data, uint64_t length, bool end )
+	{
+		ZSTD_inBuffer input{ data, length, 0 };
+		while ( !m_failed )
+		{
+			ZSTD_outBuffer output{ m_compressed.data(), m_compressed.size(), 0 };
+			size_t remaining = ZSTD_compressStream2( m_context, &output, &input, end ? ZSTD_e_end : ZSTD_e_continue );
+			if ( ZSTD_isError( remaining ) )
+			{
+				STASH_LOG_ERROR_PARAMS( "Failed to compress cut output: %s", ZSTD_getErrorName( remaining ) );
+				m_failed = true;
+				break;
+			}
+
+			if ( !writeAll( m_compressed.data(), output.pos ) )
+				break;
+
+			if ( end ? remaining == 0 : input.pos == input.size )
+				break;
+		}
+
+		return !m_failed;
+	}
+
+	bool AssemblyWriter::flush()
+	{
+		struct iovec vectors[ IOV_MAX ];
+		size_t span = 0;
+
+		while ( span < m_spans.size() && !m_failed )
+		{
+			size_t count = std::min< size_t >( IOV_MAX, m_spans.size() - span );
+			for ( size_t i = 0; i < count; i++ )
+			{
+				const Span& entry = m_spans[ span + i ];
+				vectors[ i ].iov_base = ( void* ) ( entry.data ? entry.data : m_text.data() + entry.offset );
+				vectors[ i ].iov_len = entry.length;
+			}
+			span += count;
+
+			if ( m_context != nullptr )
+			{
+				for ( size_t i = 0; i < count; i++ )
+					compress( ( const char* ) vectors[ i ].iov_base, vectors[ i ].iov_len, false );
+				continue;
+			}
+
+			// Writes can be partial, so the written vectors are skipped before writing the rest.
+			struct iovec* vector = vectors;
+			while ( count > 0 )
+			{
+				ssize_t written = writev( m_file, vector, ( int ) count );
+				if ( written < 0 )
+				{
+					if ( errno == EINTR )
+						continue;
+
+					STASH_LOG_ERROR_PARAMS( "Failed to write cut output: %s", strerror( errno ) );
+					m_failed = true;
+					break;
+				}
+
+				while ( count > 0 && ( size_t ) written >= vector->iov_len )
+				{
+					written -= vector->iov_len;
+					vector++;
+					count--;
+				}
+
+				if ( count > 0 )
+				{
+					vector->iov_base = ( char* ) vector->iov_base + written;
+					vector->iov_len -= written;
+				}
+			}
+		}
+
+		m_spans.clear();
+		m_text.clear();
+		m_pendingBytes = 0;
+		return !m_failed;
+	}
+}
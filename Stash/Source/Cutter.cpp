@@ -0,0 +1,135 @@
+#include "Stash/Cutter.h"
+
+#include "Stash/Stash.h"
+
+#include <algorithm>
+
+namespace Stash
+{
+	MaxPooling::MaxPooling( const CutParameters& cutParameters, uint64_t signalLength, uint64_t begin, uint64_t end )
+		: m_cutThreshold( cutParameters.cutThreshold )
+		, m_maxPoolingRadius( cutParameters.maxPoolingRadius )
+		, m_head( 0 )
+		, m_tail( 0 )
+	{
+		uint64_t radius = m_maxPoolingRadius;
+
+		// Only positions whose whole pooling window fits in the signal are evaluated.
+		m_begin = std::max( begin, radius + 1 );
+		m_end = signalLength > radius + 1 ? std::min( end, signalLength - radius - 1 ) : 0;
+
+		// Position p is evaluated once signal[ p + radius - 1 ] is pushed.
+		if ( m_begin < m_end )
+		{
+			m_signalBegin = m_begin - std::max( radius, ( uint64_t ) 1 );
+			m_signalEnd = m_end + radius - 1;
+		}
+		else
+		{
+			m_signalBegin = m_signalEnd = m_begin = m_end = 0;
+		}
+
+		// The deque never holds more than a full window plus the incoming value.
+		uint64_t capacity = 1;
+		while ( capacity < 2 * radius + 2 )
+			capacity <<= 1;
+
+		m_mask = capacity - 1;
+		m_indices.resize( capacity );
+		m_values.resize( capacity );
+	}
+
+	void MaxPooling::push( uint64_t index, uint8_t value )
+	{
+		if ( index < m_signalBegin || index >= m_signalEnd )
+			return;
+
+		uint64_t radius = m_maxPoolingRadius;
+
+		// Position "index + 1 - radius" is pooled over [ position - radius, position + radius ).
+		// With no radius the window is empty and its max is zero.
+		if ( radius == 0 )
+		{
+			if ( index + 1 < m_end )
+				evaluate( index + 1, 0 );
+			return;
+		}
+
+		while ( m_tail != m_head && m_values[ ( m_tail - 1 ) & m_mask ] <= value )
+			m_tail--;
+
+		m_indices[ m_tail & m_mask ] = index;
+		m_values[ m_tail & m_mask ] = value;
+		m_tail++;
+
+		if ( index + 1 < m_begin + radius )
+			return;
+
+		uint64_t position = index + 1 - radius;
+		while ( m_indices[ m_head & m_mask ] + radius < position )
+			m_head++;
+
+		evaluate( position, m_values[ m_head & m_mask ] );
+	}
+
+	void MaxPooling::evaluate( uint64_t position, uint32_t max )
+	{
+		if ( max >= m_cutThreshold )
+			return;
+
+		if ( !m_runs.empty() && m_runs.back().end == position )
+		{
+			m_runs.back().end++;
+			m_runs.back().minimum = std::min< uint8_t >( m_runs.back().minimum, max );
+		}
+		else
+			m_runs.push_back( { position, position + 1, ( uint8_t ) max, m_lowValues.size() } );
+
+		m_lowValues.push_back( ( uint8_t ) max );
+	}
+
+	CutChain::CutChain( const CutParameters& cutParameters )
+		: m_minCutDistance( cutParameters.minCutDistance )
+		, m_lastCutPosition( 0 )
+		, m_chainStart( 0 )
+		, m_chainMinimum( 0 )
+	{
+	}
+
+	void CutChain::add( const LowRun& run, const uint8_t* values )
+	{
+		// Inside a run, only a minimum distance of one or less can start new chains, each of its own position.
+		if ( m_minCutDistance <= 1 )
+		{
+			for ( uint64_t position = run.start; position < run.end; position++ )
+				evaluate( position, values[ position - run.start ] );
+			return;
+		}
+
+		evaluate( run.start, run.minimum );
+		m_lastCutPosition = run.end - 1;
+	}
+
+	void CutChain::evaluate( uint64_t position, uint8_t minimum )
+	{
+		if ( position - m_lastCutPosition >= m_minCutDistance || m_lastCutPosition == 0 )
+		{
+			if ( m_chainStart != 0 )
+				m_breakpoints.push_back( { m_chainStart, m_lastCutPosition, m_chainMinimum } );
+
+			m_chainStart = position;
+			m_chainMinimum = minimum;
+		}
+		else
+			m_chainMinimum = std::min( m_chainMinimum, minimum );
+		m_lastCutPosition = position;
+	}
+
+	void CutChain::finish()
+	{
+		if ( m_chainStart != 0 )
+			m_breakpoints.push_back( { m_chainStart, m_lastCutPosition, m_chainMinimum } );
+
+		m_chainStart = 0;
+	}
+}
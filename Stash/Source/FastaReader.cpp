@@ -1,7 +1,11 @@
 #include "Stash/FastaReader.h"
 
+#include "Stash/MappedFastaReader.h"
+
 #include "btllib/seq_reader.hpp"
 
+#include <cstring>
+
 namespace Stash
 {
 	void ScopedFastaReader::loadAllReads( const char* path, std::vector< std::unique_ptr< Read > >& reads, uint64_t minLength )
@@ -30,59 +34,92 @@ namespace Stash
 		close();
 	}
 
-	bool ScopedFastaReader::open( const char* path )
+	bool ScopedFastaReader::open( const char* path, uint32_t threads )
 	{
+		// Standard input is mapped as well when it is redirected from a file.
+		if ( strcmp( path, "-" ) == 0 )
+			path = "/dev/stdin";
+
+		m_mappedReader = std::make_unique<MappedFastaReader>();
+		if ( m_mappedReader->open( path, threads ) )
+			return true;
+
+		m_mappedReader.reset();
 		m_reader = std::make_unique<btllib::SeqReader>( path, btllib::SeqReader::Flag::LONG_MODE );
 		return true;
 	}
 
 	void ScopedFastaReader::close()
 	{
+		if ( m_mappedReader )
+			m_mappedReader->close();
 		if ( m_reader )
 			m_reader->close();
 	}
 
+	bool ScopedFastaReader::next( SequenceView& record, bool& mapped )
+	{
+		if ( m_mappedReader )
+			return m_mappedReader->next( record, mapped );
+
+		auto seqRecord = m_reader->read();
+		if ( !seqRecord )
+			return false;
+
+		m_bases = std::move( seqRecord.seq );
+		record = SequenceView( seqRecord.id, m_bases.c_str(), m_bases.size() );
+		mapped = false;
+		return true;
+	}
+
 	uint32_t ScopedFastaReader::loadReads( uint32_t numberToRead, std::vector< std::unique_ptr< Read > >& reads, uint64_t minLength )
 	{
 		uint32_t count;
+		SequenceView record{ "", nullptr, 0 };
+		bool mapped;
 
 		for ( count = 0; count < numberToRead; count++ )
 		{
-			const auto record = m_reader->read();
-			if ( !record )
+			if ( !next( record, mapped ) )
 				break;
 
-			if ( record.seq.size() < minLength )
+			if ( record.m_length < minLength )
 			{
 				count--;
 				continue;
 			}
 
-			std::unique_ptr< Read > read = std::make_unique< Read >( record.id, record.seq.c_str(), record.seq.size() );
+			std::unique_ptr< Read > read = mapped ? std::make_unique< Read >( record, m_mappedReader->getMapping() )
+				: std::make_unique< Read >( record.m_id, record.m_sequence, record.m_length );
 			reads.push_back( std::move( read ) );
 		}
 
 		return count;
 	}
 
-	uint32_t ScopedFastaReader::loadSequences( uint32_t numberToRead, std::vector< std::unique_ptr< Sequence > >& sequences, uint64_t minLength )
+	uint32_t ScopedFastaReader::loadSequences( uint32_t numberToRead, std::vector< std::unique_ptr< Sequence > >& sequences, uint64_t minLength, uint64_t maxBases )
 	{
 		uint32_t count;
+		uint64_t bases = 0;
+		SequenceView record{ "", nullptr, 0 };
+		bool mapped;
 
-		for ( count = 0; count < numberToRead; count++ )
+		for ( count = 0; count < numberToRead && ( count == 0 || bases < maxBases ); count++ )
 		{
-			const auto record = m_reader->read();
-			if ( !record )
+			if ( !next( record, mapped ) )
 				break;
 
-			if ( record.seq.size() < minLength )
+			if ( record.m_length < minLength )
 			{
 				count--;
 				continue;
 			}
 
-			std::unique_ptr< Sequence > read = std::make_unique< Sequence >( record.id, record.seq.c_str(), record.seq.size() );
+			std::unique_ptr< Sequence > read = mapped ? std::make_unique< Sequence >( record, m_mappedReader->getMapping() )
+				: std::make_unique< Sequence >( record.m_id, record.m_sequence, record.m_length );
 			sequences.push_back( std::move( read ) );
+
+			bases += record.m_length;
 		}
 
 		return count;
@@ -0,0 +1,182 @@
+#include "Stash/HashStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Stash
+{
+	static const char s_hashStreamMagic[ 8 ] = { 'S', 'T', 'A', 'S', 'H', 'H', 'S', 'H' };
+
+	// Upper bound of a read length, so that a corrupted stream is not taken for a huge read.
+	static const uint64_t s_maxReadLength = 1ull << 40;
+
+	// The hashes of a read are read in pieces of this many words, so that a corrupted k-mer count runs into the
+	// end of the stream instead of allocating all of its hashes up front.
+	static const uint64_t s_readPieceWords = 1ull << 20;
+
+	HashStreamWriter::HashStreamWriter()
+		: m_file( nullptr )
+		, m_spacedSeedLength( 0 )
+	{
+	}
+
+	HashStreamWriter::~HashStreamWriter()
+	{
+		close();
+	}
+
+	bool HashStreamWriter::open( const char* path, const std::vector< std::string >& spacedSeeds )
+	{
+		close();
+
+		if ( spacedSeeds.empty() )
+			return false;
+
+		m_file = strcmp( path, "-" ) == 0 ? stdout : fopen( path, "wb" );
+		if ( m_file == nullptr )
+			return false;
+
+		m_spacedSeedLength = ( uint32_t ) spacedSeeds[ 0 ].size();
+		m_ntSeeds = btllib::parse_seeds( spacedSeeds );
+
+		uint32_t header[ 3 ] = { HashStream::VERSION, m_spacedSeedLength, ( uint32_t ) spacedSeeds.size() };
+		bool written = fwrite( s_hashStreamMagic, sizeof( s_hashStreamMagic ), 1, m_file ) == 1 && fwrite( header, sizeof( header ), 1, m_file ) == 1;
+		for ( const std::string& seed : spacedSeeds )
+			written = written && seed.size() == m_spacedSeedLength && fwrite( seed.data(), 1, seed.size(), m_file ) == seed.size();
+
+		return written;
+	}
+
+	bool HashStreamWriter::close()
+	{
+		if ( m_file == nullptr )
+			return true;
+
+		bool closed = m_file == stdout ? fflush( m_file ) == 0 : fclose( m_file ) == 0;
+		m_file = nullptr;
+		return closed;
+	}
+
+	bool HashStreamWriter::write( uint64_t hash1, uint64_t hash2, uint64_t length, const uint64_t* hashes, uint64_t kmers )
+	{
+		uint64_t header[ HashStream::READ_HEADER_WORDS ] = { hash1, hash2, length, kmers };
+		uint64_t words = kmers * m_ntSeeds.size();
+
+		return fwrite( header, sizeof( header ), 1, m_file ) == 1 && fwrite( hashes, sizeof( uint64_t ), words, m_file ) == words;
+	}
+
+	bool HashStreamWriter::write( const Read& read )
+	{
+		// Fill skips reads that are shorter than a k-mer.
+		if ( read.m_length < m_spacedSeedLength )
+			return true;
+
+		m_hashes.clear();
+
+		uint64_t kmers = 0;
+		btllib::SeedNtHash nt{ read.m_sequence, read.m_length, m_ntSeeds, 1, m_spacedSeedLength };
+		while ( nt.roll() )
+		{
+			m_hashes.insert( m_hashes.end(), nt.hashes(), nt.hashes() + m_ntSeeds.size() );
+			kmers++;
+		}
+
+		return write( read.m_hash1, read.m_hash2, read.m_length, m_hashes.data(), kmers );
+	}
+
+	HashStreamReader::HashStreamReader()
+		: m_file( nullptr )
+		, m_truncated( false )
+	{
+	}
+
+	HashStreamReader::~HashStreamReader()
+	{
+		close();
+	}
+
+	bool HashStreamReader::open( const char* path )
+	{
+		close();
+
+		m_file = strcmp( path, "-" ) == 0 ? stdin : fopen( path, "rb" );
+		if ( m_file == nullptr )
+			return false;
+
+		char magic[ sizeof( s_hashStreamMagic ) ];
+		uint32_t header[ 3 ];
+		if ( fread( magic, sizeof( magic ), 1, m_file ) != 1 || memcmp( magic, s_hashStreamMagic, sizeof( magic ) ) != 0
+			|| fread( header, sizeof( header ), 1, m_file ) != 1 || header[ 0 ] != HashStream::VERSION || header[ 1 ] == 0 || header[ 2 ] == 0 )
+		{
+			close();
+			return false;
+		}
+
+		m_spacedSeeds.assign( header[ 2 ], std::string( header[ 1 ], '\0' ) );
+		for ( std::string& seed : m_spacedSeeds )
+		{
+			if ( fread( &seed[ 0 ], 1, seed.size(), m_file ) != seed.size() )
+			{
+				close();
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void HashStreamReader::close()
+	{
+		if ( m_file != nullptr && m_file != stdin )
+			fclose( m_file );
+
+		m_file = nullptr;
+	}
+
+	uint32_t HashStreamReader::loadReads( uint32_t maxReads, std::vector< uint64_t >& records )
+	{
+		uint32_t count = 0;
+		for ( ; count < maxReads && m_file != nullptr; count++ )
+		{
+			uint64_t header[ HashStream::READ_HEADER_WORDS ];
+			size_t headerWords = fread( header, sizeof( uint64_t ), HashStream::READ_HEADER_WORDS, m_file );
+			if ( headerWords != HashStream::READ_HEADER_WORDS )
+			{
+				m_truncated = headerWords != 0;
+				break;
+			}
+
+			// A read has no more k-mers than spaced seeds fit in it.
+			uint64_t length = header[ 2 ], kmers = header[ 3 ];
+			uint64_t spacedSeedLength = m_spacedSeeds[ 0 ].size();
+			if ( length > s_maxReadLength || kmers > ( length >= spacedSeedLength ? length - spacedSeedLength + 1 : 0 ) )
+			{
+				m_truncated = true;
+				break;
+			}
+
+			size_t first = records.size();
+			uint64_t words = kmers * m_spacedSeeds.size();
+			records.resize( first + HashStream::READ_HEADER_WORDS );
+			memcpy( &records[ first ], header, sizeof( header ) );
+
+			for ( uint64_t read = 0; read < words && !m_truncated; )
+			{
+				uint64_t piece = std::min( words - read, s_readPieceWords );
+				size_t offset = records.size();
+				records.resize( offset + piece );
+				if ( fread( &records[ offset ], sizeof( uint64_t ), piece, m_file ) != piece )
+					m_truncated = true;
+				read += piece;
+			}
+
+			if ( m_truncated )
+			{
+				records.resize( first );
+				break;
+			}
+		}
+
+		return count;
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdio>
+
+extern FILE* s_outStream;
+
+#define STASH_LOG_INFO( message ) fprintf( s_outStream, "Stash> " message "\n" )
+#define STASH_LOG_ERROR( message ) fprintf( s_outStream, "Stash> Error: " message "\n" )
+#define STASH_LOG_INFO_PARAMS( message, ... ) fprintf( s_outStream, "Stash> " message "\n", __VA_ARGS__ )
+#define STASH_LOG_ERROR_PARAMS( message, ... ) fprintf( s_outStream, "Stash> Error: " message "\n", __VA_ARGS__ )
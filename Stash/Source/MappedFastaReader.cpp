@@ -0,0 +1,345 @@
+#include "Stash/MappedFastaReader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Log.h"
+
+namespace Stash
+{
+	// Target length of the chunks that are parsed by a single thread.
+	static const uint64_t s_chunkLength = 1ull << 25;
+
+	static const uint64_t s_noInvalidRecord = ~0ull;
+
+	MappedFastaReader::MappedFastaReader()
+		: m_length( 0 )
+		, m_fastq( false )
+		, m_threads( 1 )
+		, m_nextChunk( 0 )
+		, m_roundChunk( 0 )
+		, m_roundRecord( 0 )
+		, m_releasedOffset( 0 )
+	{
+	}
+
+	MappedFastaReader::~MappedFastaReader()
+	{
+		close();
+	}
+
+	bool MappedFastaReader::open( const char* path, uint32_t threads )
+	{
+		close();
+
+		// Opening a pipe would consume its writer, so only regular files are opened here.
+		struct stat status;
+		if ( stat( path, &status ) != 0 || !S_ISREG( status.st_mode ) || status.st_size == 0 )
+			return false;
+
+		int fileDescriptor = ::open( path, O_RDONLY );
+		if ( fileDescriptor < 0 )
+			return false;
+
+		if ( fstat( fileDescriptor, &status ) != 0 || !S_ISREG( status.st_mode ) || status.st_size == 0 )
+		{
+			::close( fileDescriptor );
+			return false;
+		}
+
+		uint64_t length = ( uint64_t ) status.st_size;
+		void* mapping = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0 );
+		::close( fileDescriptor );
+		if ( mapping == MAP_FAILED )
+			return false;
+
+		madvise( mapping, length, MADV_SEQUENTIAL );
+		m_mapping = std::shared_ptr< const char >( ( const char* ) mapping, [ length ]( const char* data ) { munmap( ( void* ) data, length ); } );
+		m_length = length;
+
+		// Anything but plain FASTA or FASTQ, e.g. a compressed file, is not read here.
+		const char* data = m_mapping.get();
+		uint64_t first = 0;
+		while ( first < m_length && isspace( ( unsigned char ) data[ first ] ) )
+			first++;
+
+		if ( first == m_length || ( data[ first ] != '>' && data[ first ] != '@' ) )
+		{
+			close();
+			return false;
+		}
+
+		m_path = path;
+		m_fastq = data[ first ] == '@';
+		m_threads = std::max( threads, 1u );
+
+		// Other formats that start alike, e.g. SAM or multi-line FASTQ, are left to btllib.
+		if ( !isValidFirstRecord( first ) )
+		{
+			close();
+			return false;
+		}
+
+		// Chunk boundaries are found up front, which only reads a few lines around each of them.
+		m_boundaries.assign( 1, first );
+		for ( uint64_t offset = first + s_chunkLength; offset < m_length; offset += s_chunkLength )
+		{
+			uint64_t boundary = findRecordStart( offset );
+			if ( boundary > m_boundaries.back() && boundary < m_length )
+				m_boundaries.push_back( boundary );
+		}
+		m_boundaries.push_back( m_length );
+
+		return true;
+	}
+
+	void MappedFastaReader::close()
+	{
+		// Sequences that refer to the file keep it mapped.
+		m_mapping.reset();
+		m_length = 0;
+		m_boundaries.clear();
+		m_round.clear();
+		m_nextChunk = 0;
+		m_roundChunk = 0;
+		m_roundRecord = 0;
+		m_releasedOffset = 0;
+	}
+
+	uint64_t MappedFastaReader::findRecordStart( uint64_t offset ) const
+	{
+		const char* data = m_mapping.get();
+		auto nextLine = [ & ]( uint64_t position )
+		{
+			const char* newline = ( const char* ) memchr( data + position, '\n', m_length - position );
+			return newline ? ( uint64_t ) ( newline - data ) + 1 : m_length;
+		};
+
+		// Records start a line. A FASTQ quality line may start with '@' as well, but it is not followed by a
+		// '+' line two lines below.
+		for ( uint64_t line = nextLine( offset - 1 ); line < m_length; line = nextLine( line ) )
+		{
+			if ( !m_fastq && data[ line ] == '>' )
+				return line;
+
+			if ( m_fastq && data[ line ] == '@' )
+			{
+				uint64_t separator = nextLine( nextLine( line ) );
+				if ( separator < m_length && data[ separator ] == '+' )
+					return line;
+			}
+		}
+
+		return m_length;
+	}
+
+	bool MappedFastaReader::isValidFirstRecord( uint64_t first ) const
+	{
+		const char* data = m_mapping.get();
+		auto lineEnd = [ & ]( uint64_t position )
+		{
+			const char* newline = ( const char* ) memchr( data + position, '\n', m_length - position );
+			return newline ? ( uint64_t ) ( newline - data ) : m_length;
+		};
+		auto nextLine = [ & ]( uint64_t position ) { return std::min( lineEnd( position ) + 1, m_length ); };
+		auto contentEnd = [ & ]( uint64_t position ) { uint64_t end = lineEnd( position ); return end > position && data[ end - 1 ] == '\r' ? end - 1 : end; };
+		auto isBases = [ & ]( uint64_t begin, uint64_t end )
+		{
+			for ( uint64_t position = begin; position < end; position++ )
+			{
+				if ( !isalpha( ( unsigned char ) data[ position ] ) && data[ position ] != '*' && data[ position ] != '-' )
+					return false;
+			}
+			return true;
+		};
+
+		uint64_t sequence = nextLine( first );
+		if ( !m_fastq )
+		{
+			// The first line after the header holds bases, or is the header of the next record.
+			while ( sequence < m_length && contentEnd( sequence ) == sequence )
+				sequence = nextLine( sequence );
+			return sequence == m_length || data[ sequence ] == '>' || isBases( sequence, contentEnd( sequence ) );
+		}
+
+		uint64_t separator = nextLine( sequence );
+		uint64_t quality = nextLine( separator );
+		return separator < m_length && data[ separator ] == '+' && isBases( sequence, contentEnd( sequence ) )
+			&& contentEnd( quality ) - quality == contentEnd( sequence ) - sequence;
+	}
+
+	void MappedFastaReader::parseChunk( uint64_t begin, uint64_t end, Chunk& chunk ) const
+	{
+		const char* data = m_mapping.get();
+		auto lineEnd = [ & ]( uint64_t position )
+		{
+			const char* newline = ( const char* ) memchr( data + position, '\n', end - position );
+			return newline ? ( uint64_t ) ( newline - data ) : end;
+		};
+		auto nextLine = [ & ]( uint64_t position ) { return std::min( lineEnd( position ) + 1, end ); };
+		// End of the content of a line, without the '\r' of a CRLF line ending.
+		auto contentEnd = [ & ]( uint64_t position, uint64_t lineEnd ) { return lineEnd > position && data[ lineEnd - 1 ] == '\r' ? lineEnd - 1 : lineEnd; };
+
+		chunk.records.clear();
+		chunk.joined.clear();
+		chunk.bases.clear();
+		chunk.invalidOffset = s_noInvalidRecord;
+
+		// Joined records point into "bases" once it stops growing.
+		std::vector< uint64_t > joinedOffsets;
+		char marker = m_fastq ? '@' : '>';
+
+		uint64_t position = begin;
+		while ( position < end )
+		{
+			if ( isspace( ( unsigned char ) data[ position ] ) )
+			{
+				position++;
+				continue;
+			}
+
+			if ( data[ position ] != marker )
+			{
+				chunk.invalidOffset = position;
+				return;
+			}
+
+			uint64_t recordStart = position;
+			uint64_t headerEnd = lineEnd( position );
+			uint64_t idEnd = position + 1;
+			while ( idEnd < headerEnd && !isspace( ( unsigned char ) data[ idEnd ] ) )
+				idEnd++;
+
+			std::string id( data + position + 1, idEnd - position - 1 );
+			position = std::min( headerEnd + 1, end );
+
+			if ( m_fastq )
+			{
+				uint64_t sequenceBegin = position;
+				uint64_t sequenceEnd = contentEnd( sequenceBegin, lineEnd( sequenceBegin ) );
+				uint64_t separator = nextLine( sequenceBegin );
+				uint64_t quality = nextLine( separator );
+				if ( separator >= end || data[ separator ] != '+' || contentEnd( quality, lineEnd( quality ) ) - quality != sequenceEnd - sequenceBegin )
+				{
+					chunk.invalidOffset = recordStart;
+					return;
+				}
+
+				chunk.records.emplace_back( id, data + sequenceBegin, sequenceEnd - sequenceBegin );
+				chunk.joined.push_back( 0 );
+				position = nextLine( quality );
+				continue;
+			}
+
+			// The first line of a FASTA record is used in place, and further lines are joined with it.
+			uint64_t sequenceBegin = position, sequenceEnd = position;
+			uint64_t joinedOffset = chunk.bases.size();
+			uint32_t lines = 0;
+			while ( position < end && data[ position ] != '>' )
+			{
+				uint64_t lineBegin = position;
+				uint64_t lineContentEnd = contentEnd( lineBegin, lineEnd( lineBegin ) );
+				position = nextLine( lineBegin );
+				if ( lineContentEnd == lineBegin )
+					continue;
+
+				if ( lines == 0 )
+				{
+					sequenceBegin = lineBegin;
+					sequenceEnd = lineContentEnd;
+				}
+				else
+				{
+					if ( lines == 1 )
+						chunk.bases.append( data + sequenceBegin, sequenceEnd - sequenceBegin );
+					chunk.bases.append( data + lineBegin, lineContentEnd - lineBegin );
+				}
+				lines++;
+			}
+
+			if ( lines <= 1 )
+			{
+				chunk.records.emplace_back( id, data + sequenceBegin, sequenceEnd - sequenceBegin );
+				chunk.joined.push_back( 0 );
+			}
+			else
+			{
+				chunk.records.emplace_back( id, nullptr, chunk.bases.size() - joinedOffset );
+				chunk.joined.push_back( 1 );
+				joinedOffsets.push_back( joinedOffset );
+			}
+		}
+
+		size_t joined = 0;
+		for ( size_t i = 0; i < chunk.records.size(); i++ )
+		{
+			if ( chunk.joined[ i ] )
+				chunk.records[ i ].m_sequence = chunk.bases.data() + joinedOffsets[ joined++ ];
+		}
+	}
+
+	bool MappedFastaReader::parseRound()
+	{
+		if ( m_nextChunk + 1 >= m_boundaries.size() )
+			return false;
+
+		// The previous rounds are used up, so their pages are released. Sequences that still refer to them
+		// fault them in again from the page cache.
+		const uint64_t pageLength = ( uint64_t ) sysconf( _SC_PAGESIZE );
+		uint64_t releaseEnd = m_boundaries[ m_nextChunk ] / pageLength * pageLength;
+		if ( releaseEnd > m_releasedOffset )
+		{
+			madvise( ( void* ) ( m_mapping.get() + m_releasedOffset ), releaseEnd - m_releasedOffset, MADV_DONTNEED );
+			m_releasedOffset = releaseEnd;
+		}
+
+		size_t chunks = std::min< size_t >( m_threads, m_boundaries.size() - 1 - m_nextChunk );
+		m_round.resize( chunks );
+
+#pragma omp parallel for num_threads( m_threads ) schedule( dynamic, 1 )
+		for ( int64_t i = 0; i < ( int64_t ) chunks; i++ )
+			parseChunk( m_boundaries[ m_nextChunk + i ], m_boundaries[ m_nextChunk + i + 1 ], m_round[ i ] );
+
+		for ( const Chunk& chunk : m_round )
+		{
+			if ( chunk.invalidOffset != s_noInvalidRecord )
+			{
+				STASH_LOG_ERROR_PARAMS( "Invalid %s record at byte %" PRIu64 " of %s", m_fastq ? "FASTQ" : "FASTA", chunk.invalidOffset, m_path.c_str() );
+				exit( -1 );
+			}
+		}
+
+		m_nextChunk += chunks;
+		m_roundChunk = 0;
+		m_roundRecord = 0;
+		return true;
+	}
+
+	bool MappedFastaReader::next( SequenceView& record, bool& mapped )
+	{
+		while ( m_roundChunk == m_round.size() || m_roundRecord == m_round[ m_roundChunk ].records.size() )
+		{
+			if ( m_roundChunk < m_round.size() )
+			{
+				m_roundChunk++;
+				m_roundRecord = 0;
+			}
+			else if ( !parseRound() )
+				return false;
+		}
+
+		Chunk& chunk = m_round[ m_roundChunk ];
+		record = std::move( chunk.records[ m_roundRecord ] );
+		mapped = !chunk.joined[ m_roundRecord ];
+		m_roundRecord++;
+		return true;
+	}
+}
@@ -0,0 +1,198 @@
+#include "Stash/Scheduler.h"
+
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <mutex>
+#include <queue>
+
+#include "Log.h"
+
+namespace Stash
+{
+	struct TaskScheduler::Queue
+	{
+		std::mutex mutex;
+		std::vector< size_t > tasks;
+		size_t head = 0;
+		size_t tail = 0;
+
+		std::atomic< size_t > count{ 0 };
+		std::atomic< uint64_t > remaining{ 0 };
+
+		uint8_t enoughPadding[ 64 ];
+	};
+
+	TaskScheduler::TaskScheduler( uint32_t threads )
+		: m_threads( std::max( threads, 1u ) )
+		, m_busySeconds( m_threads, 0.0 )
+		, m_wallSeconds( 0.0 )
+		, m_tasksRun( m_threads, 0 )
+		, m_tasksStolen( m_threads, 0 )
+	{
+		for ( uint32_t i = 0; i < m_threads; i++ )
+			m_queues.emplace_back( new Queue() );
+	}
+
+	TaskScheduler::~TaskScheduler()
+	{
+	}
+
+	size_t TaskScheduler::add( uint64_t weight )
+	{
+		m_weights.push_back( weight );
+		return m_weights.size() - 1;
+	}
+
+	void TaskScheduler::run( const std::function< void( size_t, uint32_t ) >& function )
+	{
+		if ( m_weights.empty() )
+			return;
+
+		// Longest processing time first, each task going to the least loaded thread.
+		std::vector< size_t > order( m_weights.size() );
+		for ( size_t i = 0; i < order.size(); i++ )
+			order[ i ] = i;
+
+		std::stable_sort( order.begin(), order.end(), [ this ]( size_t a, size_t b ) { return m_weights[ a ] > m_weights[ b ]; } );
+
+		typedef std::pair< uint64_t, uint32_t > Load;
+		std::priority_queue< Load, std::vector< Load >, std::greater< Load > > loads;
+		for ( uint32_t i = 0; i < m_threads; i++ )
+			loads.push( { 0, i } );
+
+		for ( size_t task : order )
+		{
+			Load load = loads.top();
+			loads.pop();
+
+			Queue& queue = *m_queues[ load.second ];
+			queue.tasks.push_back( task );
+			queue.remaining += m_weights[ task ];
+
+			load.first += m_weights[ task ];
+			loads.push( load );
+		}
+
+		for ( auto& queue : m_queues )
+		{
+			queue->head = 0;
+			queue->tail = queue->tasks.size();
+			queue->count = queue->tasks.size();
+		}
+
+		double start = omp_get_wtime();
+
+#pragma omp parallel num_threads( m_threads )
+		{
+			uint32_t thread = ( uint32_t ) omp_get_thread_num();
+			size_t task;
+
+			while ( pop( thread, task ) || steal( thread, task ) )
+			{
+				double taskStart = omp_get_wtime();
+				function( task, thread );
+				m_busySeconds[ thread ] += omp_get_wtime() - taskStart;
+				m_tasksRun[ thread ]++;
+			}
+		}
+
+		m_wallSeconds += omp_get_wtime() - start;
+
+		for ( auto& queue : m_queues )
+			queue->tasks.clear();
+
+		m_weights.clear();
+	}
+
+	bool TaskScheduler::pop( uint32_t thread, size_t& task )
+	{
+		Queue& queue = *m_queues[ thread ];
+		std::lock_guard< std::mutex > lock( queue.mutex );
+
+		if ( queue.head == queue.tail )
+			return false;
+
+		task = queue.tasks[ queue.head++ ];
+		queue.count--;
+		queue.remaining -= m_weights[ task ];
+		return true;
+	}
+
+	bool TaskScheduler::steal( uint32_t thread, size_t& task )
+	{
+		while ( true )
+		{
+			// Take from the thread with the most remaining work.
+			Queue* victim = nullptr;
+			uint64_t mostRemaining = 0;
+			for ( uint32_t i = 0; i < m_threads; i++ )
+			{
+				Queue* queue = m_queues[ i ].get();
+				if ( i == thread || queue->count == 0 )
+					continue;
+
+				uint64_t remaining = queue->remaining;
+				if ( victim == nullptr || remaining > mostRemaining )
+				{
+					victim = queue;
+					mostRemaining = remaining;
+				}
+			}
+
+			if ( victim == nullptr )
+				return false;
+
+			std::lock_guard< std::mutex > lock( victim->mutex );
+			if ( victim->head == victim->tail )
+				continue;
+
+			// The owner works from the largest task, so the smallest is stolen.
+			task = victim->tasks[ --victim->tail ];
+			victim->count--;
+			victim->remaining -= m_weights[ task ];
+			m_tasksStolen[ thread ]++;
+			return true;
+		}
+	}
+
+	void TaskScheduler::report( const char* stage ) const
+	{
+		double wall = m_wallSeconds;
+		double busy = 0.0;
+
+		for ( uint32_t i = 0; i < m_threads; i++ )
+		{
+			STASH_LOG_INFO_PARAMS( "%s thread %u: %" PRIu64 " tasks (%" PRIu64 " stolen), busy %.3fs, idle %.3fs.",
+				stage, i, m_tasksRun[ i ], m_tasksStolen[ i ], m_busySeconds[ i ], wall - m_busySeconds[ i ] );
+			busy += m_busySeconds[ i ];
+		}
+
+		if ( wall > 0.0 )
+			STASH_LOG_INFO_PARAMS( "%s load balance: %.1f%% busy over %.3fs.", stage, 100.0 * busy / ( wall * m_threads ), wall );
+	}
+
+	ReorderBuffer::ReorderBuffer( const std::function< void( size_t ) >& write )
+		: m_write( write )
+		, m_next( 0 )
+	{
+	}
+
+	void ReorderBuffer::reset( size_t count )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+
+		m_final.assign( count, false );
+		m_next = 0;
+	}
+
+	void ReorderBuffer::complete( size_t index )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+
+		m_final[ index ] = true;
+		while ( m_next < m_final.size() && m_final[ m_next ] )
+			m_write( m_next++ );
+	}
+}
@@ -15,9 +15,17 @@ namespace Stash
         m_sequence[ length ] = 0;
     }
 
+    Sequence::Sequence( const SequenceView& view, const std::shared_ptr< const char >& mapping )
+        : m_id( view.m_id )
+        , m_sequence( const_cast< char* >( view.m_sequence ) )
+        , m_length( view.m_length )
+        , m_mapping( mapping )
+    {
+    }
+
     Sequence::~Sequence()
     {
-        if ( m_sequence )
+        if ( m_sequence && !m_mapping )
             delete[]( m_sequence );
     }
 
@@ -34,4 +42,11 @@ namespace Stash
         , m_hash2( CityHash::CityHash64( ( id + "{" ).c_str(), id.size() + 1 ) )
     {
     }
+
+    Read::Read( const SequenceView& view, const std::shared_ptr< const char >& mapping )
+        : Sequence( view, mapping )
+        , m_hash1( CityHash::CityHash64( m_id.c_str(), m_id.size() ) )
+        , m_hash2( CityHash::CityHash64( ( m_id + "{" ).c_str(), m_id.size() + 1 ) )
+    {
+    }
 }
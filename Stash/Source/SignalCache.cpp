@@ -0,0 +1,106 @@
+#include "Stash/SignalCache.h"
+
+#include "Stash/Stash.h"
+#include "CityHash/city.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "Log.h"
+
+namespace Stash
+{
+	static const char s_signalMagic[ 4 ] = { 'S', 'T', 'S', 'G' };
+	static const uint32_t s_signalVersion = 1;
+
+	SignalCache::SignalCache( const std::string& directory, uint64_t stashFingerprint, const WindowParameters& windowParameters, uint32_t spacedSeedLength )
+		: m_directory( directory )
+		, m_stashFingerprint( stashFingerprint )
+	{
+		// Everything that changes the signal of a given sequence is part of the key.
+		std::vector< uint64_t > parameters = { s_signalVersion, spacedSeedLength, windowParameters.numberOfFrames, windowParameters.stride };
+		parameters.insert( parameters.end(), windowParameters.deltas.begin(), windowParameters.deltas.end() );
+
+		m_parametersHash = CityHash::CityHash64( ( const char* ) parameters.data(), parameters.size() * sizeof( uint64_t ) );
+	}
+
+	bool SignalCache::open()
+	{
+		if ( mkdir( m_directory.c_str(), 0755 ) != 0 && errno != EEXIST )
+		{
+			STASH_LOG_ERROR_PARAMS( "Cannot create signal cache directory: %s", m_directory.c_str() );
+			return false;
+		}
+
+		return true;
+	}
+
+	std::string SignalCache::getPath( const Sequence& sequence ) const
+	{
+		CityHash::uint128 key = CityHash::CityHash128WithSeed( sequence.m_sequence, sequence.m_length, { m_stashFingerprint, m_parametersHash } );
+
+		char name[ 64 ];
+		snprintf( name, sizeof( name ), "/%016" PRIx64 "%016" PRIx64 ".sig", CityHash::Uint128High64( key ), CityHash::Uint128Low64( key ) );
+
+		return m_directory + name;
+	}
+
+	bool SignalCache::load( const Sequence& sequence, uint64_t signalLength, std::vector< uint8_t >& signal ) const
+	{
+		FILE* file = fopen( getPath( sequence ).c_str(), "rb" );
+		if ( file == nullptr )
+			return false;
+
+		char magic[ 4 ];
+		uint32_t version = 0;
+		uint64_t length = 0;
+
+		bool valid = fread( magic, sizeof( magic ), 1, file ) == 1 && memcmp( magic, s_signalMagic, sizeof( magic ) ) == 0
+			&& fread( &version, sizeof( version ), 1, file ) == 1 && version == s_signalVersion
+			&& fread( &length, sizeof( length ), 1, file ) == 1 && length == signalLength;
+
+		if ( valid )
+		{
+			signal.resize( length );
+			valid = fread( signal.data(), sizeof( uint8_t ), length, file ) == length;
+		}
+
+		fclose( file );
+		return valid;
+	}
+
+	bool SignalCache::store( const Sequence& sequence, const std::vector< uint8_t >& signal ) const
+	{
+		// Written under a temporary name first, so concurrent cuts never see a partial signal.
+		std::string path = getPath( sequence );
+		std::string temporaryPath = path + "." + std::to_string( getpid() ) + "." + std::to_string( omp_get_thread_num() );
+
+		FILE* file = fopen( temporaryPath.c_str(), "wb" );
+		if ( file == nullptr )
+		{
+			STASH_LOG_ERROR_PARAMS( "Cannot write to signal cache: %s", temporaryPath.c_str() );
+			return false;
+		}
+
+		uint64_t length = signal.size();
+		bool written = fwrite( s_signalMagic, sizeof( s_signalMagic ), 1, file ) == 1
+			&& fwrite( &s_signalVersion, sizeof( s_signalVersion ), 1, file ) == 1
+			&& fwrite( &length, sizeof( length ), 1, file ) == 1
+			&& fwrite( signal.data(), sizeof( uint8_t ), length, file ) == length;
+
+		written = fclose( file ) == 0 && written;
+		if ( !written || rename( temporaryPath.c_str(), path.c_str() ) != 0 )
+		{
+			STASH_LOG_ERROR_PARAMS( "Cannot write to signal cache: %s", path.c_str() );
+			remove( temporaryPath.c_str() );
+			return false;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,145 @@
+#include "Stash/SignalTrack.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "Log.h"
+
+namespace Stash
+{
+	static const char s_trackMagic[ 8 ] = { 'S', 'T', 'A', 'S', 'H', 'S', 'I', 'G' };
+	static const char s_indexMagic[ 8 ] = { 'S', 'T', 'A', 'S', 'H', 'I', 'D', 'X' };
+	static const uint32_t s_trackVersion = 1;
+
+	SignalTrack::SignalTrack( const std::string& pathPrefix, uint32_t binSize, bool mean )
+		: m_pathPrefix( pathPrefix )
+		, m_binSize( std::max( binSize, 1u ) )
+		, m_mean( mean )
+		, m_bedGraph( nullptr )
+		, m_track( nullptr )
+		, m_offset( 0 )
+	{
+	}
+
+	SignalTrack::~SignalTrack()
+	{
+		close();
+	}
+
+	bool SignalTrack::open()
+	{
+		std::string bedGraphPath = m_pathPrefix + ".bedGraph";
+		std::string trackPath = m_pathPrefix + ".sigtrack";
+
+		m_bedGraph = fopen( bedGraphPath.c_str(), "w" );
+		m_track = fopen( trackPath.c_str(), "wb" );
+		if ( m_bedGraph == nullptr || m_track == nullptr )
+		{
+			STASH_LOG_ERROR_PARAMS( "Failed to open signal track: %s", m_bedGraph == nullptr ? bedGraphPath.c_str() : trackPath.c_str() );
+			close();
+			return false;
+		}
+
+		fprintf( m_bedGraph, "track type=bedGraph name=\"Stash matches\" description=\"%s of %u positions\"\n", m_mean ? "Mean" : "Minimum", m_binSize );
+
+		uint32_t header[ 4 ] = { s_trackVersion, m_binSize, m_mean ? 1u : 0u, m_mean ? ( uint32_t ) sizeof( float ) : ( uint32_t ) sizeof( uint8_t ) };
+		fwrite( s_trackMagic, sizeof( s_trackMagic ), 1, m_track );
+		fwrite( header, sizeof( header ), 1, m_track );
+		m_offset = sizeof( s_trackMagic ) + sizeof( header );
+
+		return true;
+	}
+
+	bool SignalTrack::close()
+	{
+		bool written = true;
+
+		if ( m_track != nullptr )
+		{
+			uint64_t indexOffset = m_offset;
+			for ( const IndexEntry& entry : m_index )
+			{
+				uint32_t nameLength = ( uint32_t ) entry.contig.size();
+				uint64_t fields[ 3 ] = { entry.start, entry.bins, entry.offset };
+				fwrite( &nameLength, sizeof( nameLength ), 1, m_track );
+				fwrite( entry.contig.data(), 1, nameLength, m_track );
+				fwrite( fields, sizeof( fields ), 1, m_track );
+			}
+
+			uint64_t footer[ 2 ] = { indexOffset, m_index.size() };
+			fwrite( footer, sizeof( footer ), 1, m_track );
+			fwrite( s_indexMagic, sizeof( s_indexMagic ), 1, m_track );
+
+			bool failed = ferror( m_track ) != 0;
+			written = fclose( m_track ) == 0 && !failed && written;
+			m_track = nullptr;
+		}
+
+		if ( m_bedGraph != nullptr )
+		{
+			bool failed = ferror( m_bedGraph ) != 0;
+			written = fclose( m_bedGraph ) == 0 && !failed && written;
+			m_bedGraph = nullptr;
+		}
+
+		m_index.clear();
+		return written;
+	}
+
+	void SignalTrack::write( const std::string& contig, uint64_t start, const std::vector< uint8_t >& signal )
+	{
+		uint64_t bins = ( signal.size() + m_binSize - 1 ) / m_binSize;
+		m_minimums.resize( bins );
+		m_means.resize( m_mean ? bins : 0 );
+
+		for ( uint64_t bin = 0; bin < bins; bin++ )
+		{
+			uint64_t first = bin * m_binSize;
+			uint64_t last = std::min< uint64_t >( first + m_binSize, signal.size() );
+
+			uint8_t minimum = signal[ first ];
+			uint64_t sum = 0;
+			for ( uint64_t position = first; position < last; position++ )
+			{
+				minimum = std::min( minimum, signal[ position ] );
+				sum += signal[ position ];
+			}
+
+			m_minimums[ bin ] = minimum;
+			if ( m_mean )
+				m_means[ bin ] = ( float ) sum / ( last - first );
+		}
+
+		m_index.push_back( { contig, start, bins, m_offset } );
+		if ( m_mean )
+			fwrite( m_means.data(), sizeof( float ), bins, m_track );
+		else
+			fwrite( m_minimums.data(), sizeof( uint8_t ), bins, m_track );
+		m_offset += bins * ( m_mean ? sizeof( float ) : sizeof( uint8_t ) );
+
+		// Bins of equal value make up a single bedGraph interval.
+		for ( uint64_t bin = 0; bin < bins; )
+		{
+			uint64_t end = bin + 1;
+			if ( m_mean )
+			{
+				while ( end < bins && m_means[ end ] == m_means[ bin ] )
+					end++;
+			}
+			else
+			{
+				while ( end < bins && m_minimums[ end ] == m_minimums[ bin ] )
+					end++;
+			}
+
+			uint64_t intervalStart = start + bin * m_binSize;
+			uint64_t intervalEnd = start + std::min< uint64_t >( end * m_binSize, signal.size() );
+			if ( m_mean )
+				fprintf( m_bedGraph, "%s\t%" PRIu64 "\t%" PRIu64 "\t%g\n", contig.c_str(), intervalStart, intervalEnd, m_means[ bin ] );
+			else
+				fprintf( m_bedGraph, "%s\t%" PRIu64 "\t%" PRIu64 "\t%u\n", contig.c_str(), intervalStart, intervalEnd, m_minimums[ bin ] );
+
+			bin = end;
+		}
+	}
+}
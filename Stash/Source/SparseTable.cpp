@@ -0,0 +1,133 @@
+#include "Stash/SparseTable.h"
+
+#include <algorithm>
+#include <omp.h>
+
+namespace Stash
+{
+	// Lines built by one task of a parallel build.
+	static const uint64_t s_buildLines = 1ull << 14;
+
+	void SparseTable::build( const uint64_t* rows, uint64_t rowCount, uint32_t threads )
+	{
+		uint64_t lines = ( rowCount + LINE_ROWS - 1 ) / LINE_ROWS;
+		int64_t tasks = ( int64_t ) ( ( lines + s_buildLines - 1 ) / s_buildLines );
+
+		// Count the non-zero rows of each task first, so that every task knows where its values go.
+		std::vector< uint64_t > firstValue( tasks + 1, 0 );
+#pragma omp parallel for num_threads( threads ) schedule( dynamic, 1 )
+		for ( int64_t task = 0; task < tasks; task++ )
+		{
+			uint64_t first = task * s_buildLines * LINE_ROWS;
+			uint64_t last = std::min( rowCount, first + s_buildLines * LINE_ROWS );
+
+			uint64_t count = 0;
+			for ( uint64_t row = first; row < last; row++ )
+				count += rows[ row ] != 0;
+
+			firstValue[ task + 1 ] = count;
+		}
+
+		for ( int64_t task = 0; task < tasks; task++ )
+			firstValue[ task + 1 ] += firstValue[ task ];
+
+		m_index.assign( lines * LINE_WORDS, 0 );
+		m_values.resize( firstValue[ tasks ] );
+
+#pragma omp parallel for num_threads( threads ) schedule( dynamic, 1 )
+		for ( int64_t task = 0; task < tasks; task++ )
+		{
+			uint64_t rank = firstValue[ task ];
+			uint64_t lastLine = std::min( lines, ( task + 1 ) * s_buildLines );
+
+			for ( uint64_t line = task * s_buildLines; line < lastLine; line++ )
+			{
+				uint64_t* words = m_index.data() + line * LINE_WORDS;
+				words[ 0 ] = rank;
+
+				uint64_t first = line * LINE_ROWS;
+				uint64_t last = std::min( rowCount, first + LINE_ROWS );
+				for ( uint64_t row = first; row < last; row++ )
+				{
+					if ( rows[ row ] == 0 )
+						continue;
+
+					words[ 1 + ( ( row - first ) >> 6 ) ] |= 1ull << ( ( row - first ) & 63 );
+					m_values[ rank++ ] = rows[ row ];
+				}
+			}
+		}
+	}
+
+	bool SparseTable::read( FILE* file, uint64_t rowCount )
+	{
+		uint64_t valueCount;
+		if ( fread( &valueCount, sizeof( uint64_t ), 1, file ) != 1 || valueCount > rowCount )
+			return false;
+
+		m_index.resize( ( rowCount + LINE_ROWS - 1 ) / LINE_ROWS * LINE_WORDS );
+		if ( fread( m_index.data(), sizeof( uint64_t ), m_index.size(), file ) != m_index.size() )
+			return false;
+
+		// Every rank must count the rows marked before its line, and only rows of the table may be marked, so that
+		// finding a row never reads past the values.
+		uint64_t rank = 0;
+		for ( uint64_t line = 0; line < m_index.size() / LINE_WORDS; line++ )
+		{
+			const uint64_t* words = m_index.data() + line * LINE_WORDS;
+			if ( words[ 0 ] != rank )
+				return false;
+
+			uint64_t rows = std::min( LINE_ROWS, rowCount - line * LINE_ROWS );
+			for ( uint64_t word = 0; word < LINE_WORDS - 1; word++ )
+			{
+				uint64_t first = word << 6;
+				uint64_t valid = first >= rows ? 0 : rows - first >= 64 ? ~0ull : ( 1ull << ( rows - first ) ) - 1;
+				if ( words[ 1 + word ] & ~valid )
+					return false;
+
+				rank += __builtin_popcountll( words[ 1 + word ] );
+			}
+		}
+
+		if ( rank != valueCount )
+			return false;
+
+		m_values.resize( valueCount );
+		return fread( m_values.data(), sizeof( uint64_t ), m_values.size(), file ) == m_values.size();
+	}
+
+	bool SparseTable::write( FILE* file ) const
+	{
+		uint64_t valueCount = m_values.size();
+
+		return fwrite( &valueCount, sizeof( uint64_t ), 1, file ) == 1
+			&& fwrite( m_index.data(), sizeof( uint64_t ), m_index.size(), file ) == m_index.size()
+			&& fwrite( m_values.data(), sizeof( uint64_t ), m_values.size(), file ) == m_values.size();
+	}
+
+	void SparseTable::copyRows( uint64_t first, uint64_t count, uint64_t* destination ) const
+	{
+		if ( count == 0 )
+			return;
+
+		// Rank of the first row, whether it is zero or not.
+		const uint64_t* line = getLine( first );
+		uint64_t offset = first % LINE_ROWS;
+		uint64_t rank = line[ 0 ];
+		for ( uint64_t i = 0; i < ( offset >> 6 ); i++ )
+			rank += __builtin_popcountll( line[ 1 + i ] );
+		rank += __builtin_popcountll( line[ 1 + ( offset >> 6 ) ] & ( ( 1ull << ( offset & 63 ) ) - 1 ) );
+
+		for ( uint64_t row = first; row < first + count; row++ )
+		{
+			line = getLine( row );
+			offset = row % LINE_ROWS;
+
+			if ( ( line[ 1 + ( offset >> 6 ) ] >> ( offset & 63 ) ) & 1 )
+				destination[ row - first ] = m_values[ rank++ ];
+			else
+				destination[ row - first ] = 0;
+		}
+	}
+}
@@ -3,32 +3,139 @@
 #include "Stash/FastaReader.h"
 #include "btllib/nthash.hpp"
 #include "Stash/Sequence.h"
+#include "Stash/Cutter.h"
+#include "Stash/Scheduler.h"
+#include "Stash/SignalCache.h"
+#include "Stash/SignalTrack.h"
+#include "Stash/HashStream.h"
+#include "Stash/AssemblyWriter.h"
+#include "CityHash/city.h"
 
 #include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
 #include <cinttypes>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
-FILE* s_outStream = stdout;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "Log.h"
 
-#define STASH_LOG_INFO( message ) fprintf( s_outStream, "Stash> " message "\n" )
-#define STASH_LOG_ERROR( message ) fprintf( s_outStream, "Stash> Error: " message "\n" )
-#define STASH_LOG_INFO_PARAMS( message, ... ) fprintf( s_outStream, "Stash> " message "\n", __VA_ARGS__ )
-#define STASH_LOG_ERROR_PARAMS( message, ... ) fprintf( s_outStream, "Stash> Error: " message "\n", __VA_ARGS__ )
+FILE* s_outStream = stdout;
 
 namespace Stash
 {
+    // Reads "length" bytes at "offset", which pread may return in parts.
+    static bool readFully( int fileDescriptor, char* buffer, uint64_t length, uint64_t offset )
+    {
+        while ( length > 0 )
+        {
+            ssize_t count = pread( fileDescriptor, buffer, length, ( off_t ) offset );
+            if ( count <= 0 )
+                return false;
+
+            buffer += count;
+            length -= ( uint64_t ) count;
+            offset += ( uint64_t ) count;
+        }
+        return true;
+    }
+
+    static bool writeFully( int fileDescriptor, const char* buffer, uint64_t length, uint64_t offset )
+    {
+        while ( length > 0 )
+        {
+            ssize_t count = pwrite( fileDescriptor, buffer, length, ( off_t ) offset );
+            if ( count <= 0 )
+                return false;
+
+            buffer += count;
+            length -= ( uint64_t ) count;
+            offset += ( uint64_t ) count;
+        }
+        return true;
+    }
+
+    // Size of the chunks of a table that are read or written by a single thread.
+    static const uint64_t s_ioChunkLength = 1ull << 26;
+
+    // Reads or writes a chunk of a table at its fixed offset in the file. The aligned part of the chunk goes
+    // through the O_DIRECT descriptor when there is one, and the rest through the buffered one.
+    static bool transferChunk( bool write, int fileDescriptor, int directDescriptor, char* data, uint64_t length, uint64_t offset )
+    {
+        uint64_t directLength = 0;
+        if ( directDescriptor >= 0 && ( uint64_t ) data % Consts::TABLE_ALIGNMENT == 0 && offset % Consts::TABLE_ALIGNMENT == 0 )
+            directLength = length / Consts::TABLE_ALIGNMENT * Consts::TABLE_ALIGNMENT;
+
+        if ( directLength > 0 )
+        {
+            bool transferred = write ? writeFully( directDescriptor, data, directLength, offset ) : readFully( directDescriptor, data, directLength, offset );
+            if ( !transferred )
+                return false;
+        }
+
+        if ( directLength == length )
+            return true;
+
+        return write ? writeFully( fileDescriptor, data + directLength, length - directLength, offset + directLength )
+            : readFully( fileDescriptor, data + directLength, length - directLength, offset + directLength );
+    }
+
+    // Opens a second descriptor of a file with O_DIRECT, or returns -1 if the file system does not support it.
+    static int openDirect( const char* path, int flags )
+    {
+        int fileDescriptor = open( path, flags | O_DIRECT );
+        if ( fileDescriptor < 0 )
+            STASH_LOG_INFO_PARAMS( "Cannot use O_DIRECT for %s, using buffered I/O.", path );
+
+        return fileDescriptor;
+    }
+
+    // Tables are page aligned, so that they can be read and written with O_DIRECT.
+    static uint64_t* allocateTable( uint64_t rows )
+    {
+        void* memory = nullptr;
+        if ( posix_memalign( &memory, Consts::TABLE_ALIGNMENT, rows * sizeof( uint64_t ) ) != 0 )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot allocate a Stash table of %" PRIu64 " MB.", ( rows * sizeof( uint64_t ) ) >> 20 );
+            exit( -1 );
+        }
+
+        return ( uint64_t* ) memory;
+    }
+
     Stash::Stash( uint32_t logRows, const std::vector<std::string>& spacedSeeds )
         : m_memory( nullptr )
+        , m_memorySource( MemorySource::Heap )
+        , m_mapping( nullptr )
+        , m_mappingLength( 0 )
+        , m_usedRows( 0 )
         , m_rows( 1ull << logRows )
         , m_spacedSeedLength( 0 )
         , m_rawSeeds( spacedSeeds )
     {
         initialize();
 
-	// Initialize the Stash memory.
-        m_memory = new uint64_t[ m_rows ];
-        memset( m_memory, 0x0, m_rows * sizeof( uint64_t ) );
+	// Anonymous memory is zero, and its pages are only mapped once fill touches them.
+        m_mappingLength = m_rows * sizeof( uint64_t );
+        m_mapping = mmap( nullptr, m_mappingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        if ( m_mapping == MAP_FAILED )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot allocate a Stash table of %" PRIu64 " MB.", m_mappingLength >> 20 );
+            exit( -1 );
+        }
+
+        m_memory = ( uint64_t* ) m_mapping;
+        m_memorySource = MemorySource::Anonymous;
     }
 
     void Stash::initialize()
@@ -46,283 +153,2172 @@ namespace Stash
         m_ntSeeds = btllib::parse_seeds( m_rawSeeds );
     }
 
-    Stash::Stash( const char* stashPath )
+    // POSIX shared memory names start with a single slash.
+    static std::string getSharedMemoryName( const std::string& name )
+    {
+        return name.empty() || name[ 0 ] != '/' ? "/" + name : name;
+    }
+
+    Stash::Stash( const char* stashPath, const LoadOptions& options )
+        : m_memory( nullptr )
+        , m_memorySource( MemorySource::Heap )
+        , m_mapping( nullptr )
+        , m_mappingLength( 0 )
+        , m_usedRows( 0 )
+    {
+	// A published Stash is attached like a file, as shared memory segments are files of their own.
+        bool shared = !options.sharedMemoryName.empty();
+        std::string source = shared ? getSharedMemoryName( options.sharedMemoryName ) : std::string( stashPath );
+
+        FILE* file = nullptr;
+        if ( shared )
+        {
+            int fileDescriptor = shm_open( source.c_str(), O_RDONLY, 0 );
+            if ( fileDescriptor >= 0 )
+                file = fdopen( fileDescriptor, "rb" );
+        }
+        else
+            file = fopen( stashPath, "rb" );
+
+        if ( file == nullptr ){
+            STASH_LOG_ERROR_PARAMS( "Cannot open Stash file: %s", source.c_str() );
+            exit( -1 );
+        }
+
+        int version;
+        uint64_t tableOffset;
+        readHeader( file, source.c_str(), version, tableOffset );
+
+        if ( version == Consts::PUBLISHING_VERSION )
+        {
+            STASH_LOG_ERROR_PARAMS( "Stash %s is still being published.", source.c_str() );
+            exit( -1 );
+        }
+
+        if ( version < 0 || version > Consts::SPARSE_FORMAT_VERSION )
+        {
+            STASH_LOG_ERROR_PARAMS( "Unsupported Stash file version %d.", version );
+            exit( -1 );
+        }
+
+        initialize();
+
+        if ( options.mapped && version == 0 )
+            STASH_LOG_INFO( "Stash file has no aligned table, so it is read instead of mapped. Saving it again upgrades it." );
+        if ( options.mapped && version == Consts::COMPRESSED_FORMAT_VERSION )
+            STASH_LOG_INFO( "Stash file is compressed, so it is decompressed instead of mapped." );
+        if ( options.mapped && version == Consts::SPARSE_FORMAT_VERSION )
+            STASH_LOG_INFO( "Stash file is sparse, so it is read instead of mapped." );
+
+	// Only raw tables can be mapped, the others are read into memory.
+        bool mappedTable = ( options.mapped || shared ) && version >= 1 && version <= Consts::RAW_FORMAT_VERSION;
+
+        if ( version == Consts::SPARSE_FORMAT_VERSION )
+        {
+            fseek( file, ( long ) tableOffset, SEEK_SET );
+            if ( !m_sparse.read( file, m_rows ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Invalid Stash. Cannot read the sparse table of %s", source.c_str() );
+                exit( -1 );
+            }
+            m_memorySource = MemorySource::Sparse;
+        }
+        else if ( version == Consts::COMPRESSED_FORMAT_VERSION )
+        {
+            if ( !readCompressedTable( file, tableOffset, options.threads ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Invalid Stash. Cannot decompress the table of %s", source.c_str() );
+                exit( -1 );
+            }
+        }
+        else if ( mappedTable )
+        {
+            mapTable( fileno( file ), source.c_str(), tableOffset, options );
+        }
+        else
+        {
+            m_memory = allocateTable( m_rows );
+            if ( !readTable( source.c_str(), fileno( file ), tableOffset, options ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Invalid Stash. Cannot read the table of %s", source.c_str() );
+                exit( -1 );
+            }
+        }
+        
+        fclose( file );
+
+        if ( shared )
+            STASH_LOG_INFO_PARAMS( "Attached shared Stash: %s", source.c_str() );
+
+	// Files without checksums predate them, so they load unverified. Mapped tables are only checked on request, so
+	// that attaching stays immediate.
+        if ( m_checksums.empty() )
+            STASH_LOG_INFO_PARAMS( "Stash %s has no checksums. Saving it again adds them.", source.c_str() );
+        else if ( options.verify == Verification::Never )
+            STASH_LOG_INFO( "Skipping the verification of the Stash checksums." );
+        else if ( options.verify == Verification::Default && shared )
+            STASH_LOG_INFO( "Shared Stash was verified when it was pinned." );
+        else if ( options.verify == Verification::Default && mappedTable )
+            STASH_LOG_INFO( "Mapped Stash is not verified. Pass --verify to check it." );
+        else if ( !verify( options.threads ) )
+        {
+            STASH_LOG_ERROR_PARAMS( "Invalid Stash. The table of %s does not match its checksums.", source.c_str() );
+            exit( -1 );
+        }
+
+        if ( m_fillStatistics.reads )
+            STASH_LOG_INFO_PARAMS( "Stash of %" PRIu64 " reads, %" PRIu64 " bases and %" PRIu64 " k-mers, with %.2f%% of its rows used.",
+                m_fillStatistics.reads, m_fillStatistics.bases, m_fillStatistics.kmers, 100.0 * m_usedRows / m_rows );
+
+        if ( options.sparse )
+            freeze( options.threads );
+    }
+
+    static const char s_stashMagic[ 8 ] = { 'S', 'T', 'A', 'S', 'H', 'T', 'B', 'L' };
+    static const uint32_t s_headerVersion = 1;
+
+    template< typename T >
+    static void appendValue( std::string& header, const T& value )
+    {
+        header.append( ( const char* ) &value, sizeof( T ) );
+    }
+
+    std::string Stash::buildHeader( int version ) const
+    {
+        std::string header( s_stashMagic, sizeof( s_stashMagic ) );
+        appendValue( header, s_headerVersion );
+        appendValue( header, ( int32_t ) version );
+
+        appendValue( header, m_spacedSeedLength );
+        appendValue( header, Consts::SPACED_SEED_COUNT );
+        for ( const std::string& seed : m_rawSeeds )
+            header.append( seed );
+
+        appendValue( header, m_rows );
+        appendValue( header, ( uint32_t ) Consts::T1 );
+        appendValue( header, ( uint32_t ) Consts::T2 );
+
+        appendValue( header, m_fillStatistics );
+        appendValue( header, m_usedRows );
+
+        appendValue( header, Consts::CHECKSUM_BLOCK_ROWS );
+        appendValue( header, ( uint64_t ) m_checksums.size() );
+        header.append( ( const char* ) m_checksums.data(), m_checksums.size() * sizeof( uint64_t ) );
+
+        appendValue( header, CityHash::CityHash64( header.data(), header.size() ) );
+
+        // Pad the header so that the table can be mapped.
+        header.resize( ( header.size() + Consts::TABLE_ALIGNMENT - 1 ) / Consts::TABLE_ALIGNMENT * Consts::TABLE_ALIGNMENT, '\0' );
+        return header;
+    }
+
+    void Stash::readHeader( FILE* file, const char* source, int& version, uint64_t& tableOffset )
+    {
+        std::string header;
+        bool complete = true;
+        auto read = [ & ]( void* value, size_t length )
+        {
+            complete = complete && fread( value, 1, length, file ) == length;
+            if ( complete )
+                header.append( ( const char* ) value, length );
+        };
+
+        char magic[ sizeof( s_stashMagic ) ] = { 0 };
+        read( magic, sizeof( magic ) );
+
+        bool legacy = memcmp( magic, s_stashMagic, sizeof( magic ) ) != 0;
+        uint32_t spacedSeedCount = 0, t1 = 0, t2 = 0;
+        if ( legacy )
+        {
+	    // Files without a magic number start with their version, and have no statistics or checksums.
+            complete = fseek( file, 0, SEEK_SET ) == 0;
+            read( &version, sizeof( int ) );
+            read( &m_spacedSeedLength, sizeof( uint32_t ) );
+            read( &spacedSeedCount, sizeof( uint32_t ) );
+        }
+        else
+        {
+            uint32_t headerVersion = 0;
+            read( &headerVersion, sizeof( uint32_t ) );
+            if ( complete && headerVersion != s_headerVersion )
+            {
+                STASH_LOG_ERROR_PARAMS( "Unsupported Stash header version %u.", headerVersion );
+                exit( -1 );
+            }
+
+            read( &version, sizeof( int ) );
+            read( &m_spacedSeedLength, sizeof( uint32_t ) );
+            read( &spacedSeedCount, sizeof( uint32_t ) );
+        }
+
+        if ( complete && ( spacedSeedCount != Consts::SPACED_SEED_COUNT || m_spacedSeedLength == 0 || m_spacedSeedLength > Consts::MAX_SPACED_SEED_LENGTH ) )
+        {
+            STASH_LOG_ERROR_PARAMS( "Invalid Stash. There should be exactly %d spaced seeds.", Consts::SPACED_SEED_COUNT );
+            exit( -1 );
+        }
+
+        for ( uint32_t i = 0; i < spacedSeedCount && complete; i++ )
+        {
+            std::string seed( m_spacedSeedLength, '\0' );
+            read( &seed[ 0 ], m_spacedSeedLength );
+            m_rawSeeds.push_back( seed );
+        }
+
+        read( &m_rows, sizeof( uint64_t ) );
+        read( &t1, sizeof( uint32_t ) );
+        read( &t2, sizeof( uint32_t ) );
+
+        if ( complete && ( t1 != Consts::T1 || t2 != Consts::T2 ) )
+        {
+            STASH_LOG_ERROR( "Invalid Stash. Invalid T1 or T2 parameters." );
+            exit( -1 );
+        }
+
+        if ( complete && ( m_rows == 0 || ( m_rows & ( m_rows - 1 ) ) ) )
+        {
+            STASH_LOG_ERROR_PARAMS( "Invalid Stash. The number of rows %" PRIu64 " is not a power of two.", m_rows );
+            exit( -1 );
+        }
+
+        if ( legacy )
+        {
+            // Since version 1, the table starts at an aligned offset so that it can be mapped.
+            tableOffset = ( uint64_t ) ftell( file );
+            if ( version >= 1 )
+                tableOffset = ( tableOffset + Consts::TABLE_ALIGNMENT - 1 ) / Consts::TABLE_ALIGNMENT * Consts::TABLE_ALIGNMENT;
+        }
+        else
+        {
+            uint64_t blockRows = 0, blocks = 0;
+            read( &m_fillStatistics, sizeof( FillStatistics ) );
+            read( &m_usedRows, sizeof( uint64_t ) );
+            read( &blockRows, sizeof( uint64_t ) );
+            read( &blocks, sizeof( uint64_t ) );
+
+            if ( complete && ( blockRows != Consts::CHECKSUM_BLOCK_ROWS || blocks != ( m_rows + blockRows - 1 ) / blockRows ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Invalid Stash. Unexpected checksum blocks in %s", source );
+                exit( -1 );
+            }
+
+            m_checksums.resize( complete ? blocks : 0 );
+            read( m_checksums.data(), m_checksums.size() * sizeof( uint64_t ) );
+
+            uint64_t expected = CityHash::CityHash64( header.data(), header.size() );
+            uint64_t checksum = 0;
+            read( &checksum, sizeof( uint64_t ) );
+
+            if ( complete && checksum != expected )
+            {
+                STASH_LOG_ERROR_PARAMS( "Invalid Stash. The header of %s is corrupted.", source );
+                exit( -1 );
+            }
+
+            tableOffset = ( header.size() + Consts::TABLE_ALIGNMENT - 1 ) / Consts::TABLE_ALIGNMENT * Consts::TABLE_ALIGNMENT;
+        }
+
+        if ( !complete )
+        {
+            STASH_LOG_ERROR_PARAMS( "Invalid Stash. The header of %s is truncated.", source );
+            exit( -1 );
+        }
+    }
+
+    void Stash::computeChecksums( const uint32_t threads, std::vector< uint64_t >& checksums, uint64_t& usedRows ) const
+    {
+        checksums.resize( ( m_rows + Consts::CHECKSUM_BLOCK_ROWS - 1 ) / Consts::CHECKSUM_BLOCK_ROWS );
+        computeChecksums( threads, 0, checksums.size(), checksums.data(), usedRows );
+    }
+
+    void Stash::computeChecksums( const uint32_t threads, uint64_t firstBlock, uint64_t blocks, uint64_t* checksums, uint64_t& usedRows ) const
+    {
+        const uint64_t blockRows = Consts::CHECKSUM_BLOCK_ROWS;
+
+        uint64_t used = 0;
+#pragma omp parallel num_threads( std::max( threads, 1u ) ) reduction( + : used )
+        {
+            std::vector< uint64_t > buffer;
+
+#pragma omp for schedule( dynamic, 1 )
+            for ( int64_t block = ( int64_t ) firstBlock; block < ( int64_t ) ( firstBlock + blocks ); block++ )
+            {
+                uint64_t first = block * blockRows;
+                uint64_t rows = std::min( blockRows, m_rows - first );
+                const uint64_t* data = readRows( first, rows, buffer );
+
+                checksums[ block - firstBlock ] = CityHash::CityHash64( ( const char* ) data, rows * sizeof( uint64_t ) );
+                for ( uint64_t row = 0; row < rows; row++ )
+                    used += data[ row ] != 0;
+            }
+        }
+
+        usedRows = used;
+    }
+
+    void Stash::updateChecksums( const uint32_t threads )
+    {
+        if ( m_checksums.empty() )
+            computeChecksums( threads, m_checksums, m_usedRows );
+    }
+
+    bool Stash::verify( const uint32_t threads ) const
+    {
+        double start = omp_get_wtime();
+
+        std::vector< uint64_t > checksums;
+        uint64_t usedRows;
+        computeChecksums( threads, checksums, usedRows );
+
+        bool valid = true;
+        for ( size_t block = 0; block < checksums.size(); block++ )
+        {
+            if ( checksums[ block ] == m_checksums[ block ] )
+                continue;
+
+            STASH_LOG_ERROR_PARAMS( "Checksum mismatch in rows %" PRIu64 " to %" PRIu64 ".",
+                block * Consts::CHECKSUM_BLOCK_ROWS, std::min( m_rows, ( block + 1 ) * Consts::CHECKSUM_BLOCK_ROWS ) );
+            valid = false;
+        }
+
+        double seconds = omp_get_wtime() - start;
+        if ( valid )
+            STASH_LOG_INFO_PARAMS( "Verified %zu Stash blocks in %.2fs (%.1f GB/s).",
+                checksums.size(), seconds, seconds > 0.0 ? m_rows * sizeof( uint64_t ) / seconds / ( 1 << 30 ) : 0.0 );
+
+        return valid;
+    }
+
+    void Stash::freeze( const uint32_t threads )
+    {
+        if ( m_memorySource == MemorySource::Sparse )
+            return;
+
+        m_sparse.build( m_memory, m_rows, std::max( threads, 1u ) );
+        releaseMemory();
+        m_memory = nullptr;
+        m_memorySource = MemorySource::Sparse;
+
+        STASH_LOG_INFO_PARAMS( "Sparse Stash: %.2f%% of the rows are used, %" PRIu64 " MB instead of %" PRIu64 " MB.",
+            100.0 * m_sparse.getNonZeroRows() / m_rows, m_sparse.getBytes() >> 20, ( m_rows * sizeof( uint64_t ) ) >> 20 );
+    }
+
+    void Stash::copyRows( uint64_t first, uint64_t count, uint64_t* destination ) const
+    {
+        if ( m_memorySource == MemorySource::Sparse )
+            m_sparse.copyRows( first, count, destination );
+        else
+            memcpy( destination, m_memory + first, count * sizeof( uint64_t ) );
+    }
+
+    const uint64_t* Stash::readRows( uint64_t first, uint64_t count, std::vector< uint64_t >& buffer ) const
+    {
+        if ( m_memorySource != MemorySource::Sparse )
+            return m_memory + first;
+
+        buffer.resize( count );
+        m_sparse.copyRows( first, count, buffer.data() );
+        return buffer.data();
+    }
+
+    void Stash::gatherRows( uint64_t* rows, uint64_t count ) const
+    {
+        if ( m_memorySource != MemorySource::Sparse )
+        {
+            for ( uint64_t i = 0; i < count; i++ )
+                rows[ i ] = m_memory[ rows[ i ] ];
+            return;
+        }
+
+	// Rank every row first and prefetch the values, so that the second reads overlap as well.
+        const uint64_t* values = m_sparse.getValues();
+        for ( uint64_t i = 0; i < count; i++ )
+        {
+            rows[ i ] = m_sparse.getRank( rows[ i ] );
+            if ( rows[ i ] != SparseTable::NO_RANK )
+                __builtin_prefetch( values + rows[ i ] );
+        }
+
+        for ( uint64_t i = 0; i < count; i++ )
+            rows[ i ] = rows[ i ] == SparseTable::NO_RANK ? 0 : values[ rows[ i ] ];
+    }
+
+    uint64_t Stash::writeHeader( FILE* file, int version ) const
+    {
+        std::string header = buildHeader( version );
+        if ( fwrite( header.data(), sizeof( char ), header.size(), file ) != header.size() )
+            return 0;
+
+        return header.size();
+    }
+
+    bool Stash::readTable( const char* stashPath, int fileDescriptor, uint64_t tableOffset, const LoadOptions& options )
+    {
+        int directDescriptor = options.directIO ? openDirect( stashPath, O_RDONLY ) : -1;
+
+	// Every thread reads fixed chunks of the table, touching their pages first.
+        uint64_t length = m_rows * sizeof( uint64_t );
+        int64_t chunks = ( int64_t ) ( ( length + s_ioChunkLength - 1 ) / s_ioChunkLength );
+        std::atomic< bool > failed{ false };
+#pragma omp parallel for num_threads( std::max( options.threads, 1u ) ) schedule( static, 1 )
+        for ( int64_t chunk = 0; chunk < chunks; chunk++ )
+        {
+            uint64_t first = chunk * s_ioChunkLength;
+            if ( !transferChunk( false, fileDescriptor, directDescriptor, ( char* ) m_memory + first, std::min( s_ioChunkLength, length - first ), tableOffset + first ) )
+                failed = true;
+        }
+
+        if ( directDescriptor >= 0 )
+            close( directDescriptor );
+
+        return !failed;
+    }
+
+    bool Stash::writeTable( const char* outputPath, int fileDescriptor, uint64_t tableOffset, const SaveOptions& options ) const
+    {
+        uint64_t length = m_rows * sizeof( uint64_t );
+        if ( ftruncate( fileDescriptor, ( off_t ) ( tableOffset + length ) ) != 0 )
+            return false;
+
+        int directDescriptor = options.directIO ? openDirect( outputPath, O_WRONLY ) : -1;
+
+        const uint64_t chunkRows = s_ioChunkLength / sizeof( uint64_t );
+        int64_t chunks = ( int64_t ) ( ( m_rows + chunkRows - 1 ) / chunkRows );
+        std::atomic< bool > failed{ false };
+#pragma omp parallel num_threads( std::max( options.threads, 1u ) )
+        {
+            std::vector< uint64_t > buffer;
+
+#pragma omp for schedule( static, 1 )
+            for ( int64_t chunk = 0; chunk < chunks; chunk++ )
+            {
+                uint64_t first = chunk * chunkRows;
+                uint64_t rows = std::min( chunkRows, m_rows - first );
+                const char* data = ( const char* ) readRows( first, rows, buffer );
+
+                if ( !transferChunk( true, fileDescriptor, directDescriptor, ( char* ) data, rows * sizeof( uint64_t ), tableOffset + first * sizeof( uint64_t ) ) )
+                    failed = true;
+            }
+        }
+
+        if ( directDescriptor >= 0 )
+            close( directDescriptor );
+
+        return !failed;
+    }
+
+    bool Stash::readCompressedTable( FILE* file, uint64_t tableOffset, uint32_t threads )
+    {
+        uint64_t blockRows = 0, blocks = 0;
+        if ( fseek( file, ( long ) tableOffset, SEEK_SET ) != 0 || fread( &blockRows, sizeof( uint64_t ), 1, file ) != 1 || fread( &blocks, sizeof( uint64_t ), 1, file ) != 1 )
+            return false;
+
+        if ( blockRows == 0 || blocks != ( m_rows + blockRows - 1 ) / blockRows )
+            return false;
+
+        // The block index holds the compressed size of every block, which are stored one after another.
+        std::vector< uint64_t > sizes( blocks );
+        if ( fread( sizes.data(), sizeof( uint64_t ), blocks, file ) != blocks )
+            return false;
+
+	// No checksum covers the block index, so it is checked before anything is allocated from it.
+        struct stat status;
+        if ( fstat( fileno( file ), &status ) != 0 )
+            return false;
+
+        uint64_t bound = ZSTD_compressBound( std::min( blockRows, m_rows ) * sizeof( uint64_t ) );
+        std::vector< uint64_t > offsets( blocks );
+        uint64_t offset = tableOffset + ( 2 + blocks ) * sizeof( uint64_t );
+        for ( uint64_t block = 0; block < blocks; block++ )
+        {
+            if ( sizes[ block ] == 0 || sizes[ block ] > bound )
+                return false;
+
+            offsets[ block ] = offset;
+            offset += sizes[ block ];
+        }
+
+        if ( offset != ( uint64_t ) status.st_size )
+            return false;
+
+        m_memory = allocateTable( m_rows );
+
+        int fileDescriptor = fileno( file );
+        std::atomic< bool > failed{ false };
+#pragma omp parallel num_threads( std::max( threads, 1u ) )
+        {
+            std::vector< char > buffer;
+
+#pragma omp for schedule( dynamic, 1 )
+            for ( int64_t block = 0; block < ( int64_t ) blocks; block++ )
+            {
+                uint64_t first = block * blockRows;
+                uint64_t length = std::min( blockRows, m_rows - first ) * sizeof( uint64_t );
+
+                buffer.resize( sizes[ block ] );
+                if ( !readFully( fileDescriptor, buffer.data(), sizes[ block ], offsets[ block ] ) )
+                {
+                    failed = true;
+                    continue;
+                }
+
+                size_t result = ZSTD_decompress( m_memory + first, length, buffer.data(), sizes[ block ] );
+                if ( ZSTD_isError( result ) || result != length )
+                    failed = true;
+            }
+        }
+
+        return !failed;
+    }
+
+    bool Stash::writeCompressedTable( FILE* file, const SaveOptions& options ) const
+    {
+        uint64_t blockRows = Consts::COMPRESSED_BLOCK_ROWS;
+        uint64_t blocks = ( m_rows + blockRows - 1 ) / blockRows;
+        if ( fwrite( &blockRows, sizeof( uint64_t ), 1, file ) != 1 || fwrite( &blocks, sizeof( uint64_t ), 1, file ) != 1 )
+            return false;
+
+        // The block index is written once every block is compressed.
+        long indexOffset = ftell( file );
+        std::vector< uint64_t > sizes( blocks, 0 );
+        if ( indexOffset < 0 || fwrite( sizes.data(), sizeof( uint64_t ), blocks, file ) != blocks )
+            return false;
+
+	// Compress a round of blocks on all threads, then write them in order.
+        uint32_t threads = std::max( options.threads, 1u );
+        size_t bound = ZSTD_compressBound( blockRows * sizeof( uint64_t ) );
+        std::vector< std::vector< char > > buffers( threads * 4 );
+        uint64_t compressedLength = 0;
+
+        for ( uint64_t round = 0; round < blocks; round += buffers.size() )
+        {
+            int64_t count = ( int64_t ) std::min< uint64_t >( buffers.size(), blocks - round );
+            std::atomic< bool > failed{ false };
+
+#pragma omp parallel for num_threads( threads ) schedule( dynamic, 1 )
+            for ( int64_t i = 0; i < count; i++ )
+            {
+                uint64_t first = ( round + i ) * blockRows;
+                uint64_t rows = std::min( blockRows, m_rows - first );
+                std::vector< uint64_t > rowBuffer;
+
+                buffers[ i ].resize( bound );
+                size_t size = ZSTD_compress( buffers[ i ].data(), bound, readRows( first, rows, rowBuffer ), rows * sizeof( uint64_t ), options.compressionLevel );
+                if ( ZSTD_isError( size ) )
+                    failed = true;
+                else
+                    sizes[ round + i ] = size;
+            }
+
+            if ( failed )
+                return false;
+
+            for ( int64_t i = 0; i < count; i++ )
+            {
+                if ( fwrite( buffers[ i ].data(), sizeof( char ), sizes[ round + i ], file ) != sizes[ round + i ] )
+                    return false;
+                compressedLength += sizes[ round + i ];
+            }
+        }
+
+        if ( fseek( file, indexOffset, SEEK_SET ) != 0 || fwrite( sizes.data(), sizeof( uint64_t ), blocks, file ) != blocks
+            || fseek( file, 0, SEEK_END ) != 0 )
+            return false;
+
+        STASH_LOG_INFO_PARAMS( "Compressed the Stash table from %" PRIu64 " MB to %" PRIu64 " MB.", ( m_rows * sizeof( uint64_t ) ) >> 20, compressedLength >> 20 );
+        return true;
+    }
+
+    bool Stash::save( const char* outputPath )
+    {
+        return save( outputPath, SaveOptions() );
+    }
+
+    bool Stash::save( const char* outputPath, const SaveOptions& options )
+    {
+        FILE* file = fopen( outputPath, "wb" );
+        if ( file == nullptr ){
+            STASH_LOG_ERROR_PARAMS( "Cannot open Stash file: %s", outputPath );
+            return false;
+        }
+
+	// The checksums cover the rows whatever the format of the table.
+        updateChecksums( options.threads );
+
+        bool written = true;
+        if ( options.sparse )
+        {
+            if ( options.compressionLevel > 0 )
+                STASH_LOG_INFO( "Sparse Stash files are not compressed." );
+
+            written = writeHeader( file, Consts::SPARSE_FORMAT_VERSION ) != 0;
+            if ( written && m_memorySource == MemorySource::Sparse )
+                written = m_sparse.write( file );
+            else if ( written )
+            {
+                SparseTable sparse;
+                sparse.build( m_memory, m_rows, std::max( options.threads, 1u ) );
+                written = sparse.write( file );
+            }
+        }
+        else if ( options.compressionLevel > 0 )
+        {
+            written = writeHeader( file, Consts::COMPRESSED_FORMAT_VERSION ) != 0 && writeCompressedTable( file, options );
+        }
+        else
+        {
+            uint64_t tableOffset = writeHeader( file, Consts::RAW_FORMAT_VERSION );
+            written = tableOffset != 0 && fflush( file ) == 0 && writeTable( outputPath, fileno( file ), tableOffset, options );
+        }
+
+	// Buffered writes only fail for sure once they are flushed.
+        written = !ferror( file ) && written;
+        written = fclose( file ) == 0 && written;
+
+        if ( !written )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot write Stash file: %s", outputPath );
+            return false;
+        }
+
+        STASH_LOG_INFO_PARAMS( "Successfully saved Stash: %s", outputPath );
+        return true;
+    }
+
+    bool Stash::publish( const char* name, const uint32_t threads )
+    {
+        std::string sharedName = getSharedMemoryName( name );
+
+        int fileDescriptor = shm_open( sharedName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644 );
+        if ( fileDescriptor < 0 )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot create shared Stash %s. Unpin it first if it exists.", sharedName.c_str() );
+            return false;
+        }
+
+	// The header is marked as being published until the table is complete, so that no cut attaches to a partial Stash.
+        updateChecksums( threads );
+        std::string header = buildHeader( Consts::PUBLISHING_VERSION );
+        uint64_t tableOffset = header.size();
+        bool written = writeFully( fileDescriptor, header.data(), header.size(), 0 );
+
+        uint64_t tableLength = m_rows * sizeof( uint64_t );
+        void* mapping = MAP_FAILED;
+        if ( written && ftruncate( fileDescriptor, ( off_t ) ( tableOffset + tableLength ) ) == 0 )
+            mapping = mmap( nullptr, tableOffset + tableLength, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0 );
+
+        if ( mapping == MAP_FAILED )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot allocate shared Stash %s of %" PRIu64 " MB.", sharedName.c_str(), tableLength >> 20 );
+            close( fileDescriptor );
+            shm_unlink( sharedName.c_str() );
+            return false;
+        }
+
+        const uint64_t blockRows = 1ull << 23;
+        int64_t blocks = ( int64_t ) ( ( m_rows + blockRows - 1 ) / blockRows );
+        uint64_t* table = ( uint64_t* ) ( ( char* ) mapping + tableOffset );
+#pragma omp parallel for num_threads( threads )
+        for ( int64_t block = 0; block < blocks; block++ )
+        {
+            uint64_t first = block * blockRows;
+            copyRows( first, std::min( blockRows, m_rows - first ), table + first );
+        }
+
+        munmap( mapping, tableOffset + tableLength );
+
+        header = buildHeader( Consts::RAW_FORMAT_VERSION );
+        bool published = writeFully( fileDescriptor, header.data(), header.size(), 0 );
+        close( fileDescriptor );
+
+        if ( !published )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot publish shared Stash %s.", sharedName.c_str() );
+            shm_unlink( sharedName.c_str() );
+            return false;
+        }
+
+        STASH_LOG_INFO_PARAMS( "Published shared Stash: %s", sharedName.c_str() );
+        return true;
+    }
+
+    bool Stash::unpublish( const char* name )
+    {
+        std::string sharedName = getSharedMemoryName( name );
+
+	// Attached cuts keep their mapping, the memory is released when the last one detaches.
+        if ( shm_unlink( sharedName.c_str() ) != 0 )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot remove shared Stash %s.", sharedName.c_str() );
+            return false;
+        }
+
+        STASH_LOG_INFO_PARAMS( "Removed shared Stash: %s", sharedName.c_str() );
+        return true;
+    }
+
+    uint64_t Stash::getFingerprint( const uint32_t threads ) const
+    {
+	// The block checksums of the file stand for the table, which is hashed only if they are missing.
+        std::vector< uint64_t > hashes = m_checksums;
+        if ( hashes.empty() )
+        {
+            uint64_t usedRows;
+            computeChecksums( threads, hashes, usedRows );
+        }
+
+        std::string seeds;
+        for ( const std::string& seed : m_rawSeeds )
+            seeds += seed;
+        hashes.push_back( CityHash::CityHash64( seeds.c_str(), seeds.size() ) );
+
+        return CityHash::CityHash64WithSeed( ( const char* ) hashes.data(), hashes.size() * sizeof( uint64_t ), m_rows );
+    }
+
+    void Stash::mapTable( int fileDescriptor, const char* stashPath, uint64_t tableOffset, const LoadOptions& options )
+    {
+        struct stat fileStatus;
+        if ( fstat( fileDescriptor, &fileStatus ) != 0 )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot open Stash file: %s", stashPath );
+            exit( -1 );
+        }
+
+        uint64_t tableLength = m_rows * sizeof( uint64_t );
+        if ( ( uint64_t ) fileStatus.st_size < tableOffset + tableLength )
+        {
+            STASH_LOG_ERROR_PARAMS( "Invalid Stash. The file is shorter than its table: %s", stashPath );
+            exit( -1 );
+        }
+
+        m_mappingLength = tableOffset + tableLength;
+        m_mapping = mmap( nullptr, m_mappingLength, PROT_READ, MAP_SHARED, fileDescriptor, 0 );
+
+        if ( m_mapping == MAP_FAILED )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot map Stash file: %s", stashPath );
+            exit( -1 );
+        }
+
+        m_memorySource = MemorySource::Mapped;
+        m_memory = ( uint64_t* ) ( ( char* ) m_mapping + tableOffset );
+
+        if ( options.prefault )
+        {
+            madvise( m_mapping, m_mappingLength, MADV_WILLNEED );
+            prefault( options.threads );
+        }
+
+        // Cut reads rows at random, so read ahead would only waste page cache.
+        madvise( m_mapping, m_mappingLength, MADV_RANDOM );
+    }
+
+    void Stash::prefault( const uint32_t threads )
+    {
+        if ( m_memorySource == MemorySource::Sparse )
+            return;
+
+        double start = omp_get_wtime();
+        const uint64_t pageRows = Consts::TABLE_ALIGNMENT / sizeof( uint64_t );
+        int64_t pages = ( int64_t ) ( ( m_rows + pageRows - 1 ) / pageRows );
+        bool writable = m_memorySource != MemorySource::Mapped;
+
+	// Touch a row of every page, so that the page faults overlap across threads. Under the default first-touch
+	// NUMA policy, the pages of the table are then spread over the nodes of the threads.
+#pragma omp parallel for num_threads( std::max( threads, 1u ) ) schedule( static, 256 )
+        for ( int64_t page = 0; page < pages; page++ )
+        {
+            uint64_t* row = m_memory + page * pageRows;
+
+            // Writable pages are written, which maps them, without changing the row.
+            if ( writable )
+                __atomic_fetch_or( row, 0ull, __ATOMIC_RELAXED );
+            else
+                ( void ) *( volatile uint64_t* ) row;
+        }
+
+        STASH_LOG_INFO_PARAMS( "Prefaulted %" PRIu64 " MB of Stash in %.2fs.", ( m_rows * sizeof( uint64_t ) ) >> 20, omp_get_wtime() - start );
+    }
+
+    void Stash::releaseMemory()
+    {
+        switch ( m_memorySource )
+        {
+        case MemorySource::Heap:
+            free( m_memory );
+            break;
+        case MemorySource::Mapped:
+        case MemorySource::Anonymous:
+            munmap( m_mapping, m_mappingLength );
+            break;
+        case MemorySource::Sparse:
+            break;
+        }
+    }
+
+    Stash::~Stash()
+    {
+        releaseMemory();
+    }
+
+    struct ThreadData_Fill
+    {
+        uint8_t readIdTiles[ Consts::READ_ID_TILES * 2 ];
+        FillStatistics statistics;
+        uint8_t enoughPadding[ 512 - Consts::READ_ID_TILES * 2 - sizeof( FillStatistics ) ];
+    };
+
+    // Adds the statistics of every thread to those of the Stash.
+    static void addFillStatistics( FillStatistics& statistics, const std::vector< ThreadData_Fill >& threadData )
+    {
+        for ( const ThreadData_Fill& data : threadData )
+        {
+            statistics.reads += data.statistics.reads;
+            statistics.bases += data.statistics.bases;
+            statistics.kmers += data.statistics.kmers;
+        }
+    }
+
+    // Groups consecutive reads into scheduler tasks of about "taskBases" bases each.
+    static void scheduleReads( TaskScheduler& scheduler, const std::vector< std::unique_ptr< Read > >& reads, uint32_t threads, std::vector< size_t >& firstRead )
+    {
+        uint64_t totalBases = 0;
+        for ( const auto& read : reads )
+            totalBases += read->m_length;
+
+        uint64_t taskBases = std::max< uint64_t >( totalBases / ( threads * 16ull ), 1 );
+
+        firstRead.clear();
+        uint64_t bases = 0;
+        for ( size_t i = 0; i < reads.size(); i++ )
+        {
+            if ( bases == 0 )
+                firstRead.push_back( i );
+
+            bases += reads[ i ]->m_length;
+            if ( bases >= taskBases || i + 1 == reads.size() )
+            {
+                scheduler.add( bases );
+                bases = 0;
+            }
+        }
+        firstRead.push_back( reads.size() );
+    }
+
+    // Creates the read ID hash tiles of a read from its read ID hashes.
+    static void computeReadIdTiles( uint64_t hash1, uint64_t hash2, uint8_t* readIdTiles )
+    {
+        for ( uint32_t tileIndex = 0; tileIndex < Consts::READ_ID_TILES * 2; )
+        {
+            readIdTiles[ tileIndex++ ] = hash1 & Consts::MAX_T1;
+            readIdTiles[ tileIndex++ ] = hash2 & Consts::MAX_T2;
+
+            hash1 >>= Consts::T1;
+            hash2 >>= Consts::T2;
+        }
+    }
+
+    void Stash::insertKmer( const uint64_t* hashes, const uint8_t* readIdTiles, uint64_t firstRow, uint64_t partitionRows )
+    {
+        const uint64_t* last = hashes + 4;
+        uint64_t xors = hashes[ 0 ] ^ hashes[ 1 ] ^ hashes[ 2 ] ^ hashes[ 3 ];
+
+        while ( hashes < last )
+        {
+	    // Update the Stash tile.
+            uint64_t tileIndex = ( ( xors ^ *hashes ) & 7 ) << 1;
+
+            uint64_t row = *hashes++ & m_lastRow;
+            if ( row - firstRow >= partitionRows )
+                continue;
+
+            uint8_t column = readIdTiles[ tileIndex ];
+
+            uint64_t number = m_memory[ row ];
+
+            // Do not overwrite if non-zero.
+            uint64_t isolatedBits = ( Consts::MAX_T2 << ( column >> 2 ) ) & number;
+            if ( isolatedBits )
+                continue;
+
+            number |= ( uint64_t ) readIdTiles[ tileIndex + 1 ] << ( column >> 2 );
+            m_memory[ row ] = number;
+        }
+    }
+
+    void Stash::insertRead( const Read& read, uint8_t* readIdTiles, FillStatistics& statistics, uint64_t firstRow, uint64_t partitionRows )
+    {
+        computeReadIdTiles( read.m_hash1, read.m_hash2, readIdTiles );
+
+	// Roll over the sequence and perform insertions.
+        statistics.reads++;
+        statistics.bases += read.m_length;
+
+        btllib::SeedNtHash nt{ read.m_sequence, read.m_length, m_ntSeeds, 1, m_spacedSeedLength };
+        while ( nt.roll() )
+        {
+            statistics.kmers++;
+            insertKmer( nt.hashes(), readIdTiles, firstRow, partitionRows );
+        }
+    }
+
+    void Stash::hashRead( const Read& read, std::vector< uint64_t >& records, FillStatistics& statistics ) const
+    {
+        size_t first = records.size();
+        records.resize( first + HashStream::READ_HEADER_WORDS );
+        computeReadIdTiles( read.m_hash1, read.m_hash2, ( uint8_t* ) &records[ first ] );
+        records[ first + 2 ] = read.m_length;
+
+        statistics.reads++;
+        statistics.bases += read.m_length;
+
+        btllib::SeedNtHash nt{ read.m_sequence, read.m_length, m_ntSeeds, 1, m_spacedSeedLength };
+        while ( nt.roll() )
+            records.insert( records.end(), nt.hashes(), nt.hashes() + Consts::SPACED_SEED_COUNT );
+
+        uint64_t kmers = ( records.size() - first - HashStream::READ_HEADER_WORDS ) / Consts::SPACED_SEED_COUNT;
+        records[ first + 3 ] = kmers;
+        statistics.kmers += kmers;
+    }
+
+    void Stash::insertRecords( const uint64_t* records, uint64_t length, uint64_t firstRow, uint64_t partitionRows )
+    {
+        const uint64_t* last = records + length;
+        while ( records < last )
+        {
+            const uint8_t* readIdTiles = ( const uint8_t* ) records;
+            uint64_t kmers = records[ 3 ];
+            records += HashStream::READ_HEADER_WORDS;
+
+            for ( uint64_t kmer = 0; kmer < kmers; kmer++, records += Consts::SPACED_SEED_COUNT )
+                insertKmer( records, readIdTiles, firstRow, partitionRows );
+        }
+    }
+
+    void Stash::fill( std::vector< std::unique_ptr< Read > >& reads, const uint32_t threads )
+    {
+        if ( m_memorySource == MemorySource::Mapped || m_memorySource == MemorySource::Sparse )
+        {
+            STASH_LOG_ERROR( "A mapped or sparse Stash is read-only and cannot be filled." );
+            return;
+        }
+
+	STASH_LOG_INFO_PARAMS( "Running Fill with %d threads.", threads );
+
+        omp_set_num_threads( ( int32_t ) threads );
+
+	// Each thread has its own local data.
+        std::vector< ThreadData_Fill > threadData;
+        threadData.resize( threads );
+
+	// Split reads between threads.
+        TaskScheduler scheduler{ threads };
+        std::vector< size_t > firstRead;
+        scheduleReads( scheduler, reads, threads, firstRead );
+
+        scheduler.run( [ & ]( size_t task, uint32_t thread )
+        {
+            for ( size_t i = firstRead[ task ]; i < firstRead[ task + 1 ]; i++ )
+            {
+                const Read& read = *reads[ i ];
+
+                if ( i % 10000 == 0 )
+                {
+#pragma omp critical
+                    STASH_LOG_INFO_PARAMS( "Processing read %zu.", i );
+                }
+
+	        // Ignore tiny reads.
+                if ( read.m_length < m_spacedSeedLength )
+                    continue;
+
+                insertRead( read, threadData[ thread ].readIdTiles, threadData[ thread ].statistics );
+            }
+        } );
+
+        scheduler.report( "Fill" );
+
+        addFillStatistics( m_fillStatistics, threadData );
+        m_checksums.clear();
+    }
+
+    // A batch of reads, or of hashed reads in the record format of insertRecords.
+    struct ReadBatch
+    {
+        std::vector< std::unique_ptr< Read > > reads;
+        std::vector< uint64_t > records;
+        // Offsets of the tasks in "records", and their weights.
+        std::vector< uint64_t > taskOffsets;
+        std::vector< uint64_t > taskWeights;
+        FillStatistics statistics;
+        uint32_t readCount = 0;
+    };
+
+    // Replaces the read ID hashes of the reads of a hash stream by their tiles, and groups the reads into tasks
+    // of about "totalBases / ( threads * 16 )" bases each, like scheduleReads.
+    static void prepareHashedBatch( ReadBatch& batch, uint32_t threads )
+    {
+        uint64_t* records = batch.records.data();
+        uint64_t length = batch.records.size();
+
+        uint64_t totalBases = 0;
+        for ( uint64_t offset = 0; offset < length; offset += HashStream::READ_HEADER_WORDS + records[ offset + 3 ] * Consts::SPACED_SEED_COUNT )
+            totalBases += records[ offset + 2 ];
+
+        uint64_t taskBases = std::max< uint64_t >( totalBases / ( threads * 16ull ), 1 );
+
+        uint64_t bases = 0;
+        batch.taskOffsets.assign( 1, 0 );
+        batch.taskWeights.clear();
+        for ( uint64_t offset = 0; offset < length; )
+        {
+            uint64_t* record = records + offset;
+            computeReadIdTiles( record[ 0 ], record[ 1 ], ( uint8_t* ) record );
+
+            batch.statistics.reads++;
+            batch.statistics.bases += record[ 2 ];
+            batch.statistics.kmers += record[ 3 ];
+
+            bases += record[ 2 ];
+            offset += HashStream::READ_HEADER_WORDS + record[ 3 ] * Consts::SPACED_SEED_COUNT;
+            if ( bases >= taskBases || offset == length )
+            {
+                batch.taskOffsets.push_back( offset );
+                batch.taskWeights.push_back( bases );
+                bases = 0;
+            }
+        }
+    }
+
+    // Hands the batches of reads of the input threads over to fill, holding at most "capacity" batches.
+    class ReadBatchQueue
+    {
+    public:
+        ReadBatchQueue( size_t capacity, size_t inputs )
+            : m_capacity( capacity )
+            , m_inputs( inputs )
+            , m_waitSeconds( 0.0 )
+        {
+        }
+
+        // Blocks while the queue is full.
+        void push( ReadBatch&& batch )
+        {
+            std::unique_lock< std::mutex > lock( m_mutex );
+            m_notFull.wait( lock, [ this ]() { return m_batches.size() < m_capacity; } );
+            m_batches.push_back( std::move( batch ) );
+            m_notEmpty.notify_one();
+        }
+
+        // Marks an input as done.
+        void finish()
+        {
+            std::lock_guard< std::mutex > lock( m_mutex );
+            m_inputs--;
+            m_notEmpty.notify_all();
+        }
+
+        // Returns false once every input is done and every batch is taken.
+        bool pop( ReadBatch& batch )
+        {
+            double start = omp_get_wtime();
+            std::unique_lock< std::mutex > lock( m_mutex );
+            m_notEmpty.wait( lock, [ this ]() { return !m_batches.empty() || m_inputs == 0; } );
+            m_waitSeconds += omp_get_wtime() - start;
+
+            if ( m_batches.empty() )
+                return false;
+
+            batch = std::move( m_batches.front() );
+            m_batches.erase( m_batches.begin() );
+            m_notFull.notify_one();
+            return true;
+        }
+
+        // Time that fill spent waiting for reads.
+        double getWaitSeconds() const { return m_waitSeconds; }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::vector< ReadBatch > m_batches;
+        size_t m_capacity;
+        size_t m_inputs;
+        double m_waitSeconds;
+    };
+
+    bool Stash::fill( const char* readsPath, const uint32_t threads )
+    {
+        return fill( std::vector< std::string >{ readsPath }, std::vector< std::string >(), threads );
+    }
+
+    bool Stash::fill( const std::vector< std::string >& readsPaths, const std::vector< std::string >& hashStreamPaths, const uint32_t threads )
+    {
+        if ( m_memorySource == MemorySource::Mapped || m_memorySource == MemorySource::Sparse )
+        {
+            STASH_LOG_ERROR( "A mapped or sparse Stash is read-only and cannot be filled." );
+            return false;
+        }
+
+	STASH_LOG_INFO_PARAMS( "Running Fill with %d threads.", threads );
+
+        std::vector< std::unique_ptr< ScopedFastaReader > > readers;
+        for ( const std::string& readsPath : readsPaths )
+        {
+            readers.push_back( std::unique_ptr< ScopedFastaReader >( new ScopedFastaReader() ) );
+            if ( !readers.back()->open( readsPath.c_str(), threads ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Failed to open reads file: %s", readsPath.c_str() );
+                return false;
+            }
+        }
+
+	// Hash streams only fit a Stash with the same spaced seeds.
+        std::vector< std::unique_ptr< HashStreamReader > > hashStreams;
+        for ( const std::string& hashStreamPath : hashStreamPaths )
+        {
+            hashStreams.push_back( std::unique_ptr< HashStreamReader >( new HashStreamReader() ) );
+            if ( !hashStreams.back()->open( hashStreamPath.c_str() ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Failed to open hash stream: %s", hashStreamPath.c_str() );
+                return false;
+            }
+
+            if ( hashStreams.back()->getSpacedSeeds() != m_rawSeeds )
+            {
+                STASH_LOG_ERROR_PARAMS( "The spaced seeds of hash stream %s differ from those of the Stash.", hashStreamPath.c_str() );
+                return false;
+            }
+        }
+
+        omp_set_num_threads( ( int32_t ) threads );
+
+        std::vector< ThreadData_Fill > threadData;
+        threadData.resize( threads );
+
+        uint32_t batchSize = 20000;
+        uint32_t totalReadsProcessed = 0;
+
+	// Every input is read by a thread of its own, so that several pipes are drained at once, while the fill
+	// threads insert the batches read before.
+        size_t inputs = readers.size() + hashStreams.size();
+        ReadBatchQueue queue{ inputs + 1, inputs };
+        std::vector< std::thread > inputThreads;
+        for ( std::unique_ptr< ScopedFastaReader >& reader : readers )
+        {
+            ScopedFastaReader* input = reader.get();
+            inputThreads.emplace_back( [ this, input, batchSize, &queue ]()
+            {
+                while ( true )
+                {
+                    ReadBatch batch;
+                    batch.readCount = input->loadReads( batchSize, batch.reads, m_spacedSeedLength );
+                    uint32_t readCount = batch.readCount;
+                    if ( readCount > 0 )
+                        queue.push( std::move( batch ) );
+
+                    if ( readCount != batchSize )
+                        break;
+                }
+
+                input->close();
+                queue.finish();
+            } );
+        }
+
+        std::atomic< bool > truncated{ false };
+        for ( std::unique_ptr< HashStreamReader >& hashStream : hashStreams )
+        {
+            HashStreamReader* input = hashStream.get();
+            inputThreads.emplace_back( [ input, batchSize, threads, &queue, &truncated ]()
+            {
+                while ( true )
+                {
+                    ReadBatch batch;
+                    batch.readCount = input->loadReads( batchSize, batch.records );
+                    uint32_t readCount = batch.readCount;
+                    if ( readCount > 0 )
+                    {
+                        prepareHashedBatch( batch, threads );
+                        queue.push( std::move( batch ) );
+                    }
+
+                    if ( readCount != batchSize )
+                        break;
+                }
+
+                truncated = truncated || input->isTruncated();
+                input->close();
+                queue.finish();
+            } );
+        }
+
+        TaskScheduler scheduler{ threads };
+        std::vector< size_t > firstRead;
+        ReadBatch batch;
+        FillStatistics hashedStatistics;
+
+        while ( queue.pop( batch ) )
+        {
+            if ( batch.records.empty() )
+            {
+                scheduleReads( scheduler, batch.reads, threads, firstRead );
+                scheduler.run( [ & ]( size_t task, uint32_t thread )
+                {
+                    for ( size_t i = firstRead[ task ]; i < firstRead[ task + 1 ]; i++ )
+                        insertRead( *batch.reads[ i ], threadData[ thread ].readIdTiles, threadData[ thread ].statistics );
+                } );
+            }
+            else
+            {
+                for ( uint64_t weight : batch.taskWeights )
+                    scheduler.add( weight );
+
+                scheduler.run( [ & ]( size_t task, uint32_t )
+                {
+                    insertRecords( batch.records.data() + batch.taskOffsets[ task ], batch.taskOffsets[ task + 1 ] - batch.taskOffsets[ task ], 0, ~0ull );
+                } );
+
+                hashedStatistics.reads += batch.statistics.reads;
+                hashedStatistics.bases += batch.statistics.bases;
+                hashedStatistics.kmers += batch.statistics.kmers;
+            }
+
+            totalReadsProcessed += batch.readCount;
+            STASH_LOG_INFO_PARAMS( "Total Processed Reads: %" PRId32, totalReadsProcessed );
+
+            batch = ReadBatch();
+        }
+
+        for ( std::thread& thread : inputThreads )
+            thread.join();
+
+        scheduler.report( "Fill" );
+        STASH_LOG_INFO_PARAMS( "Fill waited %.2fs for reads.", queue.getWaitSeconds() );
+
+        addFillStatistics( m_fillStatistics, threadData );
+        m_fillStatistics.reads += hashedStatistics.reads;
+        m_fillStatistics.bases += hashedStatistics.bases;
+        m_fillStatistics.kmers += hashedStatistics.kmers;
+        m_checksums.clear();
+
+        if ( truncated )
+        {
+            STASH_LOG_ERROR( "A hash stream ended in the middle of a read." );
+            return false;
+        }
+
+        return true;
+    }
+
+    struct FillProgress
+    {
+        uint32_t pass;
+        uint32_t passes;
+        // Reads of the current pass, and of the whole input once the first pass is done.
+        uint64_t reads;
+        uint64_t totalReads;
+        double start;
+        double passStart;
+    };
+
+    static void reportFillProgress( const FillProgress& progress )
+    {
+        double now = omp_get_wtime();
+        if ( progress.totalReads == 0 )
+        {
+            STASH_LOG_INFO_PARAMS( "Pass %u/%u: %" PRIu64 " reads processed in %.1fs.", progress.pass + 1, progress.passes, progress.reads, now - progress.passStart );
+            return;
+        }
+
+	// Every pass goes over the same reads, so the remaining passes take about as long as the previous ones.
+        double fraction = std::min( 1.0, ( double ) progress.reads / progress.totalReads );
+        double passEta = fraction > 0.0 ? ( now - progress.passStart ) * ( 1.0 - fraction ) / fraction : 0.0;
+        double passSeconds = ( progress.passStart - progress.start ) / progress.pass;
+        STASH_LOG_INFO_PARAMS( "Pass %u/%u: %.1f%% of the reads processed, ETA %.0fs for the pass and %.0fs in total.",
+            progress.pass + 1, progress.passes, 100.0 * fraction, passEta, passEta + passSeconds * ( progress.passes - progress.pass - 1 ) );
+    }
+
+    bool Stash::fillPartition( const char* readsPath, uint64_t firstRow, uint64_t partitionRows, FILE* cacheInput, FILE* cacheOutput, const uint32_t threads, FillProgress& progress )
+    {
+        std::vector< ThreadData_Fill > threadData;
+        threadData.resize( threads );
+
+        TaskScheduler scheduler{ threads };
+        std::vector< std::vector< uint64_t > > taskRecords;
+        progress.reads = 0;
+
+	// A batch of the read cache holds its number of tasks and of reads, then the weight, the length and the
+	// records of each task. Tasks keep the weights of the first pass, so that they run in the same order.
+        if ( cacheInput != nullptr )
+        {
+            uint64_t batch[ 2 ];
+            while ( fread( batch, sizeof( uint64_t ), 2, cacheInput ) == 2 )
+            {
+                taskRecords.resize( batch[ 0 ] );
+                for ( std::vector< uint64_t >& records : taskRecords )
+                {
+                    uint64_t task[ 2 ];
+                    if ( fread( task, sizeof( uint64_t ), 2, cacheInput ) != 2 )
+                        return false;
+
+                    records.resize( task[ 1 ] );
+                    if ( fread( records.data(), sizeof( uint64_t ), task[ 1 ], cacheInput ) != task[ 1 ] )
+                        return false;
+
+                    scheduler.add( task[ 0 ] );
+                }
+
+                scheduler.run( [ & ]( size_t task, uint32_t )
+                {
+                    insertRecords( taskRecords[ task ].data(), taskRecords[ task ].size(), firstRow, partitionRows );
+                } );
+
+                progress.reads += batch[ 1 ];
+                reportFillProgress( progress );
+            }
+
+            return feof( cacheInput ) && !ferror( cacheInput );
+        }
+
+        ScopedFastaReader reader{};
+        if ( !reader.open( readsPath, threads ) )
+        {
+            STASH_LOG_ERROR_PARAMS( "Failed to open reads file: %s", readsPath );
+            return false;
+        }
+
+        std::vector< std::unique_ptr< Read > > reads;
+        std::vector< size_t > firstRead;
+        uint32_t batchSize = 20000;
+        bool written = true;
+
+	// Hashed tasks are written to the cache in order and released as soon as they are inserted.
+        ReorderBuffer cacheWriter{ [ & ]( size_t task )
+        {
+            uint64_t header[ 2 ] = { 0, taskRecords[ task ].size() };
+            for ( size_t i = firstRead[ task ]; i < firstRead[ task + 1 ]; i++ )
+                header[ 0 ] += reads[ i ]->m_length;
+
+            written = written && fwrite( header, sizeof( uint64_t ), 2, cacheOutput ) == 2
+                && fwrite( taskRecords[ task ].data(), sizeof( uint64_t ), header[ 1 ], cacheOutput ) == header[ 1 ];
+            std::vector< uint64_t >().swap( taskRecords[ task ] );
+        } };
+
+        while ( true )
+        {
+            uint32_t readCount = reader.loadReads( batchSize, reads, m_spacedSeedLength );
+
+            scheduleReads( scheduler, reads, threads, firstRead );
+            if ( cacheOutput != nullptr )
+            {
+                uint64_t batch[ 2 ] = { firstRead.size() - 1, readCount };
+                written = written && fwrite( batch, sizeof( uint64_t ), 2, cacheOutput ) == 2;
+                taskRecords.assign( firstRead.size() - 1, std::vector< uint64_t >() );
+                cacheWriter.reset( taskRecords.size() );
+            }
+
+            scheduler.run( [ & ]( size_t task, uint32_t thread )
+            {
+                ThreadData_Fill& data = threadData[ thread ];
+                if ( cacheOutput == nullptr )
+                {
+                    for ( size_t i = firstRead[ task ]; i < firstRead[ task + 1 ]; i++ )
+                        insertRead( *reads[ i ], data.readIdTiles, data.statistics, firstRow, partitionRows );
+                    return;
+                }
+
+                for ( size_t i = firstRead[ task ]; i < firstRead[ task + 1 ]; i++ )
+                    hashRead( *reads[ i ], taskRecords[ task ], data.statistics );
+
+                insertRecords( taskRecords[ task ].data(), taskRecords[ task ].size(), firstRow, partitionRows );
+                cacheWriter.complete( task );
+            } );
+
+            progress.reads += readCount;
+            reportFillProgress( progress );
+
+            if ( readCount != batchSize )
+                break;
+
+            reads.clear();
+        }
+
+        reader.close();
+
+	// Every pass sees the same reads, so only the first one counts them.
+        if ( progress.pass == 0 )
+            addFillStatistics( m_fillStatistics, threadData );
+
+        return written;
+    }
+
+    bool Stash::fill( const char* readsPath, const char* outputPath, const uint32_t threads, const FillOptions& options )
+    {
+        if ( m_memorySource != MemorySource::Anonymous )
+        {
+            STASH_LOG_ERROR( "Only a new Stash can be filled in partitions." );
+            return false;
+        }
+
+	// Partitions are made of whole checksum blocks, so that each one is checksummed before it is released.
+        uint64_t blockRows = std::min( m_rows, Consts::CHECKSUM_BLOCK_ROWS );
+        uint64_t blocks = m_rows / blockRows;
+        uint64_t partitionBlocks = ( blocks + std::max( options.partitions, 1u ) - 1 ) / std::max( options.partitions, 1u );
+        uint64_t partitionRows = partitionBlocks * blockRows;
+        uint32_t passes = ( uint32_t ) ( ( blocks + partitionBlocks - 1 ) / partitionBlocks );
+
+        STASH_LOG_INFO_PARAMS( "Running Fill with %d threads in %u partitions of %" PRIu64 " MB.", threads, passes, ( partitionRows * sizeof( uint64_t ) ) >> 20 );
+
+        FILE* cache = nullptr;
+        if ( passes > 1 && !options.readCachePath.empty() )
+        {
+            cache = fopen( options.readCachePath.c_str(), "w+b" );
+            if ( cache == nullptr )
+                STASH_LOG_INFO_PARAMS( "Cannot open read cache %s, parsing the reads on every pass.", options.readCachePath.c_str() );
+        }
+
+	// Reads from stdin or a pipe are gone after the first pass.
+        struct stat status;
+        bool rereadable = strcmp( readsPath, "-" ) != 0 && stat( readsPath, &status ) == 0 && S_ISREG( status.st_mode );
+        if ( passes > 1 && cache == nullptr && !rereadable )
+        {
+            STASH_LOG_ERROR_PARAMS( "Reads from %s cannot be read once per partition, fill them with a read cache.", readsPath );
+            return false;
+        }
+
+        int fileDescriptor = open( outputPath, O_CREAT | O_TRUNC | O_WRONLY, 0644 );
+        if ( fileDescriptor < 0 )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot open Stash file: %s", outputPath );
+            if ( cache != nullptr )
+            {
+                fclose( cache );
+                remove( options.readCachePath.c_str() );
+            }
+            return false;
+        }
+
+	// The file is marked incomplete until every partition and its checksums are written.
+        m_checksums.assign( blocks, 0 );
+        m_usedRows = 0;
+        std::string header = buildHeader( Consts::PUBLISHING_VERSION );
+        uint64_t tableOffset = header.size();
+        bool written = writeFully( fileDescriptor, header.data(), header.size(), 0 )
+            && ftruncate( fileDescriptor, ( off_t ) ( tableOffset + m_rows * sizeof( uint64_t ) ) ) == 0;
+
+        int directDescriptor = options.directIO ? openDirect( outputPath, O_WRONLY ) : -1;
+
+        FillProgress progress{ 0, passes, 0, 0, omp_get_wtime(), 0.0 };
+        for ( uint32_t pass = 0; pass < passes && written; pass++ )
+        {
+            uint64_t firstRow = pass * partitionRows;
+            uint64_t rows = std::min( partitionRows, m_rows - firstRow );
+            progress.pass = pass;
+            progress.passStart = omp_get_wtime();
+
+            if ( cache != nullptr && pass > 0 )
+                rewind( cache );
+
+            if ( !fillPartition( readsPath, firstRow, rows, pass > 0 ? cache : nullptr, pass == 0 ? cache : nullptr, threads, progress ) )
+            {
+                STASH_LOG_ERROR_PARAMS( "Cannot fill partition %u of the Stash.", pass + 1 );
+                written = false;
+                break;
+            }
+
+            if ( pass == 0 )
+                progress.totalReads = std::max< uint64_t >( progress.reads, 1 );
+
+	    // Write the partition on all threads, checksum it and release its pages.
+            const uint64_t chunkRows = s_ioChunkLength / sizeof( uint64_t );
+            int64_t chunks = ( int64_t ) ( ( rows + chunkRows - 1 ) / chunkRows );
+            std::atomic< bool > failed{ false };
+#pragma omp parallel for num_threads( std::max( threads, 1u ) ) schedule( static, 1 )
+            for ( int64_t chunk = 0; chunk < chunks; chunk++ )
+            {
+                uint64_t first = firstRow + chunk * chunkRows;
+                uint64_t count = std::min( chunkRows, firstRow + rows - first );
+                if ( !transferChunk( true, fileDescriptor, directDescriptor, ( char* ) ( m_memory + first ), count * sizeof( uint64_t ), tableOffset + first * sizeof( uint64_t ) ) )
+                    failed = true;
+            }
+            written = !failed;
+
+            uint64_t usedRows = 0;
+            uint64_t firstBlock = firstRow / Consts::CHECKSUM_BLOCK_ROWS;
+            computeChecksums( threads, firstBlock, ( rows + blockRows - 1 ) / blockRows, m_checksums.data() + firstBlock, usedRows );
+            m_usedRows += usedRows;
+
+            madvise( m_memory + firstRow, rows * sizeof( uint64_t ), MADV_DONTNEED );
+
+            double now = omp_get_wtime();
+            STASH_LOG_INFO_PARAMS( "Pass %u/%u saved rows %" PRIu64 " to %" PRIu64 " in %.2fs, ETA %.0fs.", pass + 1, passes, firstRow, firstRow + rows,
+                now - progress.passStart, ( now - progress.start ) / ( pass + 1 ) * ( passes - pass - 1 ) );
+        }
+
+        if ( cache != nullptr )
+        {
+            fclose( cache );
+            remove( options.readCachePath.c_str() );
+        }
+
+        if ( directDescriptor >= 0 )
+            close( directDescriptor );
+
+        if ( written )
+        {
+            header = buildHeader( Consts::RAW_FORMAT_VERSION );
+            written = writeFully( fileDescriptor, header.data(), header.size(), 0 );
+        }
+
+        close( fileDescriptor );
+
+	// The table in memory is empty now, so the checksums of the file do not apply to it.
+        m_checksums.clear();
+
+        if ( !written )
+        {
+            STASH_LOG_ERROR_PARAMS( "Cannot write Stash file: %s", outputPath );
+            return false;
+        }
+
+        STASH_LOG_INFO_PARAMS( "Successfully saved Stash: %s", outputPath );
+        return true;
+    }
+
+    struct ThreadData_Cut
+    {
+        uint64_t* frames;
+
+        // Scratch memory of coarse-to-fine evaluation, per chunk position.
+        std::vector< uint8_t > loaded;
+        std::vector< uint8_t > values;
+        std::vector< uint8_t > computed;
+        std::vector< int32_t > certified;
+        std::vector< int32_t > needed;
+        std::vector< uint64_t > positions;
+
+        uint8_t enoughPadding[ 512 ];
+    };
+
+    // Derived sizes shared by every contig of a cut run.
+    struct CutGeometry
+    {
+        WindowParameters window;
+        uint32_t chunkSize;
+        uint32_t windowSize;
+        uint32_t shift;
+        uint32_t distance;
+        uint64_t minContigLength;
+        uint32_t lastValidHashOffset;
+        // Positions between coarse signal samples, or 0 to evaluate every position.
+        uint32_t coarseStep;
+
+        // Each delta compares windows "distances[ i ]" apart, starting "offsets[ i ]" after the position,
+        // so that every scale is centered on the same cut position.
+        std::vector< uint32_t > distances;
+        std::vector< uint32_t > offsets;
+    };
+
+    // A range of signal positions of a sequence that is computed by a single thread, and pooled for every set of cut parameters.
+    struct CutSegment
+    {
+        CutSegment( size_t sequenceIndex, const std::vector< CutParameters >& cutParameters, uint64_t signalLength, uint64_t begin, uint64_t end )
+            : sequenceIndex( sequenceIndex )
+            , begin( begin )
+            , end( end )
+            , signalBegin( ~0ull )
+            , signalEnd( 0 )
+            , signal( nullptr )
+        {
+            for ( const CutParameters& parameters : cutParameters )
+            {
+                poolings.emplace_back( parameters, signalLength, begin, end );
+
+                // The signal is computed once over the ranges of all poolings.
+                const MaxPooling& pooling = poolings.back();
+                if ( pooling.getSignalBegin() == pooling.getSignalEnd() )
+                    continue;
+
+                signalBegin = std::min( signalBegin, pooling.getSignalBegin() );
+                signalEnd = std::max( signalEnd, pooling.getSignalEnd() );
+            }
+
+            if ( signalBegin > signalEnd )
+                signalBegin = signalEnd = 0;
+
+            rollPosition = signalBegin;
+        }
+
+        // Extends the computed signal to all of [ begin, end ), to be stored in "signal".
+        void store( uint8_t* sequenceSignal )
+        {
+            signalBegin = signalBegin == signalEnd ? begin : std::min( signalBegin, begin );
+            signalEnd = std::max( signalEnd, end );
+            rollPosition = signalBegin;
+            signal = sequenceSignal;
+        }
+
+        size_t sequenceIndex;
+        uint64_t begin;
+        uint64_t end;
+        uint64_t signalBegin;
+        uint64_t signalEnd;
+        // Where ntHash has to start rolling to reproduce the hashes of a serial roll.
+        uint64_t rollPosition;
+        std::vector< MaxPooling > poolings;
+        // If set, receives the signal of the sequence over [ begin, end ).
+        uint8_t* signal;
+    };
+
+    static const uint64_t s_exhaustedRoll = ~0ull;
+
+    // Number of positions whose Stash rows are prefetched together before being read.
+    static const uint64_t s_gatherBlock = 32;
+
+    // Whether ntHash rolls over every position of the sequence without skipping any.
+    static bool isPlainSequence( const Sequence& sequence )
+    {
+        for ( uint64_t i = 0; i < sequence.m_length; i++ )
+        {
+            switch ( sequence.m_sequence[ i ] )
+            {
+            case 'A': case 'C': case 'G': case 'T':
+            case 'a': case 'c': case 'g': case 't':
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Counts the max number of matches between the frames of two windows.
+    static uint8_t countWindowMatches( const uint64_t* frames, uint64_t frameIndex, uint32_t distance, const WindowParameters& windowParameters )
+    {
+        uint8_t matchSet[ 16 * 16 ];
+        int maxMatches = 0;
+
+        uint64_t lastFrame1 = frameIndex + windowParameters.numberOfFrames * windowParameters.stride;
+        uint64_t lastFrame2 = lastFrame1 + distance;
+        for ( uint64_t index1 = frameIndex; index1 < lastFrame1; index1 += windowParameters.stride ){
+            for ( uint64_t index2 = frameIndex + distance; index2 < lastFrame2; index2 += windowParameters.stride ){
+                memset( matchSet, 0x0, 256 );
+                for ( int row = 0; row < 4; ){
+                    uint64_t frame = frames[ ( index1 << 2 ) + row++ ];
+
+                    matchSet[ ( ( frame & 15 ) << 4 ) ] = 1;
+
+                    for ( int column = 1; column < 15; ){
+                        matchSet[ ( frame & 240 ) + column++ ] = 1;
+                        frame >>= 4;
+                    }
+
+                    matchSet[ ( frame & 240 ) + 15 ] = 1;
+                }
+
+                memset( matchSet, 0x0, 16 );
+
+                int matches = 0;
+                for ( int row = 0; row < 4; )
+                {
+                    uint64_t frame = frames[ ( index2 << 2 ) + row++ ];
+
+                    int pair = ( frame & 15 ) << 4;
+                    matches += matchSet[ pair ];
+                    matchSet[ pair ] = 0;
+
+                    for ( int column = 1; column < 15; )
+                    {
+                        pair = ( frame & 240 ) + column++;
+                        matches += matchSet[ pair ];
+                        matchSet[ pair ] = 0;
+                        frame >>= 4;
+                    }
+
+                    pair = ( frame & 240 ) + 15;
+                    matches += matchSet[ pair ];
+                    matchSet[ pair ] = 0;
+                }
+
+                if ( matches > maxMatches )
+                    maxMatches = matches;
+            }
+        }
+
+        return ( uint8_t ) maxMatches;
+    }
+
+    // The matches of a position are those of its weakest scale. Multiple scales share the frames.
+    static uint8_t computeMatches( const uint64_t* frames, uint64_t frameIndex, const CutGeometry& geometry )
+    {
+        uint8_t matches = 0xFF;
+        for ( size_t scale = 0; scale < geometry.distances.size(); scale++ )
+            matches = std::min( matches, countWindowMatches( frames, frameIndex + geometry.offsets[ scale ], geometry.distances[ scale ], geometry.window ) );
+
+        return matches;
+    }
+
+    void Stash::loadFrames( const CutGeometry& geometry, ThreadData_Cut& threadData, const std::vector< uint64_t >& positions ) const
+    {
+        uint64_t* frames = threadData.frames;
+        uint8_t* loaded = threadData.loaded.data();
+        uint32_t stride = geometry.window.stride;
+        uint32_t numberOfFrames = geometry.window.numberOfFrames;
+
+        // Visits the frames of both windows of every scale of a position.
+        auto forEachFrame = [ & ]( uint64_t position, auto&& visit )
+        {
+            for ( size_t scale = 0; scale < geometry.distances.size(); scale++ )
+            {
+                for ( uint32_t frame = 0; frame < numberOfFrames; frame++ )
+                {
+                    uint64_t index = position + geometry.offsets[ scale ] + frame * stride;
+                    visit( index );
+                    visit( index + geometry.distances[ scale ] );
+                }
+            }
+        };
+
+        uint64_t framesPerPosition = 2 * numberOfFrames * geometry.distances.size();
+        uint64_t blockPositions = std::max< uint64_t >( 1, s_gatherBlock / framesPerPosition );
+
+        for ( size_t first = 0; first < positions.size(); first += blockPositions )
+        {
+            size_t last = std::min( positions.size(), first + blockPositions );
+
+            for ( size_t i = first; i < last; i++ )
+            {
+                forEachFrame( positions[ i ], [ & ]( uint64_t index )
+                {
+                    if ( !loaded[ index ] )
+                    {
+                        for ( int row = 0; row < 4; row++ )
+                            prefetchRow( frames[ ( index << 2 ) + row ] );
+                    }
+                } );
+            }
+
+            for ( size_t i = first; i < last; i++ )
+            {
+                forEachFrame( positions[ i ], [ & ]( uint64_t index )
+                {
+                    if ( !loaded[ index ] )
+                    {
+                        gatherRows( frames + ( index << 2 ), 4 );
+                        loaded[ index ] = 1;
+                    }
+                } );
+            }
+        }
+    }
+
+    uint64_t Stash::evaluateCoarseToFine( const CutGeometry& geometry, ThreadData_Cut& threadData, CutSegment& segment, uint64_t firstPosition, uint64_t lastPosition ) const
     {
-        FILE* file = fopen( stashPath, "rb" );
-        if ( file == nullptr ){
-            STASH_LOG_ERROR_PARAMS( "Cannot open Stash file: %s", stashPath );
-            exit( -1 );
-        }
+        uint64_t count = lastPosition - firstPosition;
+        uint32_t step = geometry.coarseStep;
 
-        int legacy;
-        fread( &legacy, sizeof( int ), 1, file );
-        
-        fread( &m_spacedSeedLength, sizeof( int ), 1, file );
+        uint8_t* values = threadData.values.data();
+        uint8_t* computed = threadData.computed.data();
+        std::vector< uint64_t >& positions = threadData.positions;
+        memset( computed, 0x0, count );
 
-        int spacedSeedCount;
-        fread( &spacedSeedCount, sizeof( int ), 1, file );
-        
-        if ( spacedSeedCount != Consts::SPACED_SEED_COUNT )
-        {
-            STASH_LOG_ERROR_PARAMS( "Invalid Stash. There should be exactly %d spaced seeds.", Consts::SPACED_SEED_COUNT );
-            exit( -1 );
-        }
+        // Coarse pass, on a grid that does not depend on how the sequence is split.
+        positions.clear();
+        for ( uint64_t position = ( firstPosition + step - 1 ) / step * step; position < lastPosition; position += step )
+            positions.push_back( position - firstPosition );
 
-        char seed[ 200 ];
-        for ( uint32_t i = 0; i < Consts::SPACED_SEED_COUNT; i++ ){
-            fread( seed, sizeof( char ), m_spacedSeedLength, file );
-            seed[ m_spacedSeedLength ] = 0;
-            m_rawSeeds.emplace_back( seed );
+        loadFrames( geometry, threadData, positions );
+        for ( uint64_t position : positions )
+        {
+            values[ position ] = computeMatches( threadData.frames, position, geometry );
+            computed[ position ] = 1;
         }
+        uint64_t evaluated = positions.size();
 
-        fread( &m_rows, sizeof( uint64_t ), 1, file );
+	// A sample at or above the threshold keeps every position whose pooling window holds it from being cut.
+	// The windows of the other positions, including those reaching outside of the chunk, are refined.
+        int32_t* needed = threadData.needed.data();
+        memset( needed, 0x0, ( count + 1 ) * sizeof( int32_t ) );
 
-        int t1, t2;
-        fread( &t1, sizeof( int ), 1, file );
-        fread( &t2, sizeof( int ), 1, file );
-
-        if ( t1 != Consts::T1 || t2 != Consts::T2 )
+        for ( const MaxPooling& pooling : segment.poolings )
         {
-            STASH_LOG_ERROR( "Invalid Stash. Invalid T1 or T2 parameters." );
-            exit( -1 );
-        }
+            uint64_t radius = pooling.getMaxPoolingRadius();
+            if ( radius == 0 || pooling.getSignalBegin() == pooling.getSignalEnd() )
+                continue;
 
-        initialize();
+            // Position "p" of the chunk is at "p + radius" in "certified".
+            std::vector< int32_t >& certified = threadData.certified;
+            certified.assign( count + 2 * radius + 1, 0 );
+            for ( uint64_t position : positions )
+            {
+                if ( values[ position ] < pooling.getCutThreshold() )
+                    continue;
 
-        m_memory = new uint64_t[ m_rows ];
-        fread( m_memory, sizeof( uint64_t ), m_rows, file );
-        
-        fclose( file );
-    }
+                certified[ position + 1 ]++;
+                certified[ position + 2 * radius + 1 ]--;
+            }
 
-    bool Stash::save( const char* outputPath )
-    {
-        FILE* file = fopen( outputPath, "wb" );
-        if ( file == nullptr ){
-            STASH_LOG_ERROR_PARAMS( "Cannot open Stash file: %s", outputPath );
-            return false;
-        }
+            int32_t certifiers = 0;
+            for ( uint64_t index = 0; index < count + 2 * radius; index++ )
+            {
+                certifiers += certified[ index ];
+                if ( certifiers )
+                    continue;
 
-        int legacy = 0;
-        fwrite( &legacy, sizeof( int ), 1, file );
-        
-        fwrite( &m_spacedSeedLength, sizeof( int ), 1, file );
-        
-        int spacedSeedCount = Consts::SPACED_SEED_COUNT;
-        fwrite( &spacedSeedCount, sizeof( int ), 1, file );
-        for ( int i = 0; i < spacedSeedCount; i++ )
-            fwrite( m_rawSeeds[ i ].c_str(), sizeof( char ), m_spacedSeedLength, file );
+                needed[ index > 2 * radius ? index - 2 * radius : 0 ]++;
+                needed[ std::min( index, count ) ]--;
+            }
+        }
 
-        fwrite( &m_rows, sizeof( uint64_t ), 1, file );
-        
-        int t1 = Consts::T1;
-        int t2 = Consts::T2;
-        fwrite( &t1, sizeof( int ), 1, file );
-        fwrite( &t2, sizeof( int ), 1, file );
-        
-        fwrite( m_memory, sizeof( uint64_t ), m_rows, file );
+        // Fine pass.
+        positions.clear();
+        int32_t refining = 0;
+        for ( uint64_t position = 0; position < count; position++ )
+        {
+            refining += needed[ position ];
+            if ( refining && !computed[ position ] )
+                positions.push_back( position );
+        }
 
-        fclose( file );
+        loadFrames( geometry, threadData, positions );
+        for ( uint64_t position : positions )
+        {
+            values[ position ] = computeMatches( threadData.frames, position, geometry );
+            computed[ position ] = 1;
+        }
+        evaluated += positions.size();
 
-        STASH_LOG_INFO_PARAMS( "Successfully saved Stash: %s", outputPath );
-        return true;
-    }
+        // Positions left out only fall in pooling windows that are already above the threshold, so their max is enough.
+        for ( uint64_t position = 0; position < count; position++ )
+        {
+            uint8_t matches = computed[ position ] ? values[ position ] : 0xFF;
+            for ( MaxPooling& pooling : segment.poolings )
+                pooling.push( firstPosition + position, matches );
+        }
 
-    Stash::~Stash()
-    {
-        if ( m_memory )
-            delete[]( m_memory );
+        return evaluated;
     }
 
-    struct ThreadData_Fill
-    {
-        uint8_t readIdTiles[ Consts::READ_ID_TILES * 2 ];
-        uint8_t enoughPadding[ 512 - Consts::READ_ID_TILES * 2 ];
-    };
-
-    void Stash::fill( std::vector< std::unique_ptr< Read > >& reads, const uint32_t threads )
+    uint64_t Stash::computeSignal( const Sequence& sequence, const CutGeometry& geometry, ThreadData_Cut& threadData, CutSegment& segment ) const
     {
-	STASH_LOG_INFO_PARAMS( "Running Fill with %d threads.", threads );
-
-        omp_set_num_threads( ( int32_t ) threads );
-
-	// Each thread has its own local data.
-        std::vector< ThreadData_Fill > threadData;
-        threadData.resize( threads );
+        if ( segment.signalBegin == segment.signalEnd )
+            return 0;
+
+        // Stored signals need every position.
+        bool adaptive = geometry.coarseStep > 1 && !segment.signal;
+        uint64_t evaluated = 0;
+
+        uint64_t* frames = threadData.frames;
+        uint8_t* loaded = threadData.loaded.data();
+        uint32_t chunkSize = geometry.chunkSize;
+        uint32_t lastValidHashOffset = geometry.lastValidHashOffset;
+        uint64_t* copySource = frames + ( chunkSize - lastValidHashOffset ) * Consts::SPACED_SEED_COUNT;
+        uint32_t copySize = lastValidHashOffset * Consts::SPACED_SEED_COUNT * sizeof( uint64_t );
 
-	// Split reads between threads.
-	int64_t readsCount = ( int64_t ) reads.size();
-#pragma omp parallel for schedule( dynamic )
-        for ( int64_t i = 0; i < readsCount; ++i )
-        {
-            Read* read = reads[ i ].get();
+        uint64_t maxHashes = segment.signalEnd + lastValidHashOffset;
+        uint64_t hashCounter = segment.signalBegin;
+        uint64_t currentBatchCounter = 0;
 
-            if ( i % 10000 == 0 )
-            {
-#pragma omp critical
-                STASH_LOG_INFO_PARAMS( "Processing read %" PRId64 ".", i );
-            }
+        bool rolling = segment.rollPosition != s_exhaustedRoll;
+        btllib::SeedNtHash nt{ sequence.m_sequence, sequence.m_length, m_ntSeeds, 1, m_spacedSeedLength, rolling ? segment.rollPosition : 0 };
+        while ( 1 ){
+            while ( hashCounter < maxHashes && currentBatchCounter < chunkSize ){
+                uint64_t blockEnd = std::min< uint64_t >( currentBatchCounter + s_gatherBlock, std::min< uint64_t >( chunkSize, currentBatchCounter + maxHashes - hashCounter ) );
+                uint64_t rolledEnd = currentBatchCounter;
 
-	    // Ignore tiny reads.
-            if ( read->m_length < m_spacedSeedLength )
-                continue;
+                // Roll the whole block first and prefetch its rows, so the row reads overlap instead of waiting on each other.
+                for ( ; rolledEnd < blockEnd; rolledEnd++ )
+                {
+                    rolling = rolling && nt.roll();
+                    if ( !rolling )
+                        break;
 
-            uint8_t* readIdTiles = threadData[ omp_get_thread_num() ].readIdTiles;
+                    uint64_t* rows = frames + ( rolledEnd << 2 );
+                    for ( int i = 0; i < 4; i++ )
+                    {
+                        rows[ i ] = nt.hashes()[ i ] & m_lastRow;
+                        if ( !adaptive )
+                            prefetchRow( rows[ i ] );
+                    }
+                }
 
-            uint64_t hash1 = read->m_hash1;
-            uint64_t hash2 = read->m_hash2;
+                // Coarse-to-fine evaluation only reads the rows of the frames it compares.
+                if ( adaptive )
+                {
+                    memset( loaded + currentBatchCounter, 0x0, rolledEnd - currentBatchCounter );
+                    memset( loaded + rolledEnd, 0x1, blockEnd - rolledEnd );
+                }
+                else
+                    gatherRows( frames + ( currentBatchCounter << 2 ), ( rolledEnd - currentBatchCounter ) << 2 );
 
-	    // Create read ID hash tiles.
-            for ( uint32_t tileIndex = 0; tileIndex < Consts::READ_ID_TILES * 2; )
-            {
-                readIdTiles[ tileIndex++ ] = hash1 & Consts::MAX_T1;
-                readIdTiles[ tileIndex++ ] = hash2 & Consts::MAX_T2;
+                // Positions past the last k-mer have empty frames.
+                memset( frames + ( rolledEnd << 2 ), 0x0, ( blockEnd - rolledEnd ) * Consts::SPACED_SEED_COUNT * sizeof( uint64_t ) );
 
-                hash1 >>= Consts::T1;
-                hash2 >>= Consts::T2;
+                hashCounter += blockEnd - currentBatchCounter;
+                currentBatchCounter = blockEnd;
             }
 
-	    // Roll over the sequence and perform insertions.
-            btllib::SeedNtHash nt{ read->m_sequence, read->m_length, m_ntSeeds, 1, m_spacedSeedLength };
-            while ( nt.roll() )
+            uint64_t firstPosition = hashCounter - currentBatchCounter;
+            if ( adaptive )
+                evaluated += evaluateCoarseToFine( geometry, threadData, segment, firstPosition, hashCounter - lastValidHashOffset );
+            else
             {
-                const uint64_t* hashes = nt.hashes();
-                const uint64_t* last = hashes + 4;
-                uint64_t xors = hashes[ 0 ] ^ hashes[ 1 ] ^ hashes[ 2 ] ^ hashes[ 3 ];
-
-                while ( hashes < last )
+                for ( uint64_t position = firstPosition; position < hashCounter - lastValidHashOffset; position++ )
                 {
-		    // Update the Stash tile.
-                    uint64_t tileIndex = ( ( xors ^ *hashes ) & 7 ) << 1;
+                    uint8_t matches = computeMatches( frames, position - firstPosition, geometry );
 
-                    uint64_t row = *hashes++ & m_lastRow;
-                    uint8_t column = readIdTiles[ tileIndex ];
+                    if ( segment.signal && position >= segment.begin && position < segment.end )
+                        segment.signal[ position ] = matches;
+                    for ( MaxPooling& pooling : segment.poolings )
+                        pooling.push( position, matches );
+                }
 
-                    uint64_t number = m_memory[ row ];
+                evaluated += hashCounter - lastValidHashOffset - firstPosition;
+            }
 
-                    // Do not overwrite if non-zero.
-                    uint64_t isolatedBits = ( Consts::MAX_T2 << ( column >> 2 ) ) & number;
-                    if ( isolatedBits )
-                        continue;
+            if ( hashCounter == maxHashes )
+                break;
 
-                    number |= ( uint64_t ) readIdTiles[ tileIndex + 1 ] << ( column >> 2 );
-                    m_memory[ row ] = number;
-                }
-            }
+            memcpy( frames, copySource, copySize );
+            if ( adaptive )
+                memcpy( loaded, loaded + chunkSize - lastValidHashOffset, lastValidHashOffset );
+            currentBatchCounter = lastValidHashOffset;
         }
+
+        return evaluated;
     }
 
-    bool Stash::fill( const char* readsPath, const uint32_t threads )
+    // Writes the pieces of a sequence between its breakpoints.
+    static void writeCutSequence( AssemblyWriter& output, const Sequence& sequence, const std::vector< Breakpoint >& breakpoints, uint32_t shift )
     {
-	STASH_LOG_INFO_PARAMS( "Running Fill with %d threads.", threads );
+        char header[ 2000 ];
+        uint64_t start = 0;
 
-        ScopedFastaReader reader{};
-        if ( !reader.open( readsPath ) )
+        for ( const Breakpoint& breakpoint : breakpoints )
         {
-            STASH_LOG_ERROR_PARAMS( "Failed to open reads file: %s", readsPath );
-            return false;
-        }
+            uint64_t end = ( breakpoint.chainStart + breakpoint.chainEnd ) / 2 + shift;
 
-        omp_set_num_threads( ( int32_t ) threads );
+            snprintf( header, sizeof( header ), "%s:%" PRIu64 "-%" PRIu64, sequence.m_id.c_str(), start, end );
+            output.writeRecord( header, sequence, start, end );
 
-        std::vector< ThreadData_Fill > threadData;
-        threadData.resize( threads );
+            start = end;
+        }
 
-        std::vector< std::unique_ptr< Read > > reads;
+        if ( start )
+            snprintf( header, sizeof( header ), "%s:%" PRIu64 "-%" PRIu64, sequence.m_id.c_str(), start, sequence.m_length );
+        else
+            snprintf( header, sizeof( header ), "%s", sequence.m_id.c_str() );
 
-        uint32_t batchSize = 20000;
-        uint32_t totalReadsProcessed = 0;
+        output.writeRecord( header, sequence, start, sequence.m_length );
+    }
 
-        while ( true )
-        {
-            uint32_t readCount = reader.loadReads( batchSize, reads, m_spacedSeedLength );
+    // Writes where a sequence is cut. BED and TSV list its breakpoints, and AGP lists the same pieces as
+    // writeCutSequence, each as an object made of a single component of the sequence.
+    static void writeBreakpoints( FILE* output, CutFormat format, const Sequence& sequence, const std::vector< Breakpoint >& breakpoints, uint32_t shift )
+    {
+        const char* id = sequence.m_id.c_str();
 
-		int64_t readsCount = ( int64_t ) reads.size();
-#pragma omp parallel for schedule( dynamic )
-            for ( int64_t i = 0; i < readsCount; ++i )
+        if ( format == CutFormat::Agp )
+        {
+            uint64_t start = 0;
+            for ( size_t i = 0; i <= breakpoints.size(); i++ )
             {
-                Read* read = reads[ i ].get();
+                uint64_t end = i < breakpoints.size() ? ( breakpoints[ i ].chainStart + breakpoints[ i ].chainEnd ) / 2 + shift : sequence.m_length;
 
-                uint8_t* readIdTiles = threadData[ omp_get_thread_num() ].readIdTiles;
+                if ( breakpoints.empty() )
+                    fprintf( output, "%s", id );
+                else
+                    fprintf( output, "%s:%" PRIu64 "-%" PRIu64, id, start, end );
 
-                uint64_t hash1 = read->m_hash1;
-                uint64_t hash2 = read->m_hash2;
+                fprintf( output, "\t1\t%" PRIu64 "\t1\tW\t%s\t%" PRIu64 "\t%" PRIu64 "\t+\n", end - start, id, start + 1, end );
+                start = end;
+            }
+            return;
+        }
 
-                for ( uint32_t tileIndex = 0; tileIndex < Consts::READ_ID_TILES * 2; )
-                {
-                    readIdTiles[ tileIndex++ ] = hash1 & Consts::MAX_T1;
-                    readIdTiles[ tileIndex++ ] = hash2 & Consts::MAX_T2;
+        for ( const Breakpoint& breakpoint : breakpoints )
+        {
+            uint64_t position = ( breakpoint.chainStart + breakpoint.chainEnd ) / 2 + shift;
+            uint64_t chainStart = breakpoint.chainStart + shift;
+            uint64_t chainEnd = breakpoint.chainEnd + shift + 1;
+
+            if ( format == CutFormat::Bed )
+                fprintf( output, "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%u\n", id, chainStart, chainEnd, position, breakpoint.minimum );
+            else
+                fprintf( output, "%s\t%" PRIu64 "\t%u\t%" PRIu64 "\t%" PRIu64 "\n", id, position, breakpoint.minimum, chainStart, chainEnd );
+        }
+    }
 
-                    hash1 >>= Consts::T1;
-                    hash2 >>= Consts::T2;
-                }
+    // Sorted and merged [ start, end ) intervals of each contig, in contig coordinates.
+    typedef std::unordered_map< std::string, std::vector< std::pair< uint64_t, uint64_t > > > CutRegions;
 
-                btllib::SeedNtHash nt{ read->m_sequence, read->m_length, m_ntSeeds, 1, m_spacedSeedLength };
-                while ( nt.roll() )
-                {
-                    const uint64_t* hashes = nt.hashes();
-                    const uint64_t* last = hashes + 4;
-                    uint64_t xors = hashes[ 0 ] ^ hashes[ 1 ] ^ hashes[ 2 ] ^ hashes[ 3 ];
+    // Loads the intervals of a BED file. Header, track and comment lines are skipped.
+    static bool loadRegions( const std::string& path, CutRegions& regions )
+    {
+        std::ifstream file( path );
+        if ( !file.is_open() )
+        {
+            STASH_LOG_ERROR_PARAMS( "Failed to open regions file: %s", path.c_str() );
+            return false;
+        }
 
-                    while ( hashes < last )
-                    {
-                        uint64_t tileIndex = ( ( xors ^ *hashes ) & 7 ) << 1;
+        std::string line;
+        uint64_t lineNumber = 0, count = 0;
+        while ( std::getline( file, line ) )
+        {
+            lineNumber++;
+            if ( line.empty() || line[ 0 ] == '#' || line.compare( 0, 5, "track" ) == 0 || line.compare( 0, 7, "browser" ) == 0 )
+                continue;
 
-                        uint64_t row = *hashes++ & m_lastRow;
-                        uint8_t column = readIdTiles[ tileIndex ];
+            char contig[ 1024 ];
+            uint64_t start, end;
+            if ( sscanf( line.c_str(), "%1023s %" SCNu64 " %" SCNu64, contig, &start, &end ) != 3 || start >= end )
+            {
+                STASH_LOG_ERROR_PARAMS( "Invalid region at line %" PRIu64 " of %s", lineNumber, path.c_str() );
+                return false;
+            }
 
-                        uint64_t number = m_memory[ row ];
+            regions[ contig ].emplace_back( start, end );
+            count++;
+        }
 
-                        // Do not overwrite if non-zero.
-                        uint64_t isolatedBits = ( Consts::MAX_T2 << ( column >> 2 ) ) & number;
-                        if ( isolatedBits )
-                            continue;
+        for ( auto& contigRegions : regions )
+        {
+            std::vector< std::pair< uint64_t, uint64_t > >& intervals = contigRegions.second;
+            std::sort( intervals.begin(), intervals.end() );
 
-                        number |= ( uint64_t ) readIdTiles[ tileIndex + 1 ] << ( column >> 2 );
-                        m_memory[ row ] = number;
-                    }
-                }
+            size_t merged = 0;
+            for ( size_t i = 1; i < intervals.size(); i++ )
+            {
+                if ( intervals[ i ].first <= intervals[ merged ].second )
+                    intervals[ merged ].second = std::max( intervals[ merged ].second, intervals[ i ].second );
+                else
+                    intervals[ ++merged ] = intervals[ i ];
             }
+            intervals.resize( merged + 1 );
+        }
 
-            totalReadsProcessed += readCount;
-            STASH_LOG_INFO_PARAMS( "Total Processed Reads: %" PRId32, totalReadsProcessed );
+        STASH_LOG_INFO_PARAMS( "Loaded %" PRIu64 " regions on %zu contigs.", count, regions.size() );
+        return true;
+    }
 
-            if ( readCount != batchSize )
-                break;
+    // Whether a position lies in one of the sorted intervals.
+    static bool isInRegions( const std::vector< std::pair< uint64_t, uint64_t > >& intervals, uint64_t position )
+    {
+        auto next = std::upper_bound( intervals.begin(), intervals.end(), std::pair< uint64_t, uint64_t >( position, ~0ull ) );
+        return next != intervals.begin() && position < ( next - 1 )->second;
+    }
 
-            reads.clear();
-        }
+    // Names the output of one set of a parameter sweep, e.g. "out.fa" becomes "out.x11.m1.d1000.fa".
+    static std::string getSweepOutputPath( const std::string& outputPath, const CutParameters& cutParameters )
+    {
+        char suffix[ 64 ];
+        snprintf( suffix, sizeof( suffix ), ".x%u.m%u.d%u", cutParameters.cutThreshold, cutParameters.maxPoolingRadius, cutParameters.minCutDistance );
 
-        reader.close();
+        size_t extension = outputPath.find_last_of( '.' );
+        size_t directory = outputPath.find_last_of( '/' );
+        if ( extension == std::string::npos || ( directory != std::string::npos && extension < directory ) || extension == directory + 1 )
+            return outputPath + suffix;
 
-        return true;
+        return outputPath.substr( 0, extension ) + suffix + outputPath.substr( extension );
     }
 
-    struct ThreadData_Cut
+    bool Stash::cut( const char* assemblyPath, const char* outputPath, const WindowParameters& windowParameters, const CutParameters& cutParameters, const uint32_t threads, const CutOptions& options ) const
     {
-        std::vector< SequenceView > outputAssembly;
-        uint64_t* frames;
-        uint64_t* copySource;
-        char header[ 2000 ];
-        uint8_t enoughPadding[ 512 ];
-    };
+        return cut( assemblyPath, outputPath, windowParameters, std::vector< CutParameters >{ cutParameters }, threads, options );
+    }
 
-    bool Stash::cut( const char* assemblyPath, const char* outputPath, const WindowParameters& windowParameters, const CutParameters& cutParameters, const uint32_t threads ) const
+    bool Stash::cut( const char* assemblyPath, const char* outputPath, const WindowParameters& windowParameters, const std::vector< CutParameters >& cutParameters, const uint32_t threads, const CutOptions& options ) const
     {
 	STASH_LOG_INFO_PARAMS( "Running Cut with %d threads.", threads );
 
+        if ( cutParameters.empty() || windowParameters.deltas.empty() )
+        {
+            STASH_LOG_ERROR( "No cut parameters or deltas given." );
+            return false;
+        }
+
+	// The signal of a restricted cut covers only parts of the contigs, which the cache and the track cannot hold.
+        if ( !options.regionsPath.empty() && ( !options.signalCachePath.empty() || !options.signalTrackPath.empty() ) )
+        {
+            STASH_LOG_ERROR( "The signal of a cut restricted to regions can neither be cached nor exported." );
+            return false;
+        }
+
+        if ( options.compressionLevel > 0 && options.index )
+        {
+            STASH_LOG_ERROR( "A compressed output cannot be indexed." );
+            return false;
+        }
+
         ScopedFastaReader reader{};
-        if ( !reader.open( assemblyPath ) )
+        if ( !reader.open( assemblyPath, threads ) )
         {
             STASH_LOG_ERROR_PARAMS( "Failed to open assembly file: %s", assemblyPath );
             return false;
         }
 
-        std::ofstream outputFile;
-        outputFile.open( outputPath );
-        if ( !outputFile.is_open() ){
-            STASH_LOG_ERROR_PARAMS( "Failed to open output file: %s", outputPath );
+	// Optionally restrict the signal to regions of the contigs, which leaves every other contig uncut.
+        CutRegions regions;
+        bool restricted = !options.regionsPath.empty();
+        if ( restricted && !loadRegions( options.regionsPath, regions ) )
             return false;
+
+	// Optionally reuse the signals of contigs cut before with the same Stash and window parameters.
+        std::unique_ptr< SignalCache > signalCache;
+        if ( !options.signalCachePath.empty() )
+        {
+            uint64_t fingerprint = getFingerprint( threads );
+            STASH_LOG_INFO_PARAMS( "Stash fingerprint: %016" PRIx64, fingerprint );
+
+            signalCache.reset( new SignalCache( options.signalCachePath, fingerprint, windowParameters, m_spacedSeedLength ) );
+            if ( !signalCache->open() )
+                return false;
+        }
+
+	// Optionally export the signal of every contig, which is then kept until the contig is written.
+        std::unique_ptr< SignalTrack > signalTrack;
+        if ( !options.signalTrackPath.empty() )
+        {
+            signalTrack.reset( new SignalTrack( options.signalTrackPath, options.signalBinSize, options.signalBinMean ) );
+            if ( !signalTrack->open() )
+                return false;
+        }
+
+	// A sweep writes one output per set of cut parameters.
+        size_t parameterSets = cutParameters.size();
+	// Breakpoint formats write no sequences.
+        bool fasta = options.format == CutFormat::Fasta;
+        std::vector< AssemblyWriter > outputs( fasta ? parameterSets : 0 );
+        std::vector< FILE* > breakpointOutputs( fasta ? 0 : parameterSets, nullptr );
+
+        AssemblyWriterOptions writerOptions;
+        writerOptions.assemblyPath = assemblyPath;
+        writerOptions.compressionLevel = options.compressionLevel;
+        writerOptions.threads = threads;
+        writerOptions.index = options.index;
+        for ( size_t p = 0; p < parameterSets; p++ )
+        {
+            std::string path = parameterSets == 1 ? std::string( outputPath ) : getSweepOutputPath( outputPath, cutParameters[ p ] );
+
+            bool opened = fasta ? outputs[ p ].open( path.c_str(), writerOptions ) : ( breakpointOutputs[ p ] = fopen( path.c_str(), "w" ) ) != nullptr;
+            if ( !opened ){
+                STASH_LOG_ERROR_PARAMS( "Failed to open output file: %s", path.c_str() );
+                for ( FILE* output : breakpointOutputs )
+                    if ( output )
+                        fclose( output );
+                return false;
+            }
+
+            if ( options.format == CutFormat::Agp )
+                fprintf( breakpointOutputs[ p ], "##agp-version\t2.0\n" );
+            else if ( options.format == CutFormat::Tsv )
+                fprintf( breakpointOutputs[ p ], "#contig\tposition\tminimum\tchain_start\tchain_end\n" );
+
+            if ( parameterSets > 1 )
+                STASH_LOG_INFO_PARAMS( "Cut Parameters: threshold %u, max pooling radius %u, min cut distance %u -> %s",
+                    cutParameters[ p ].cutThreshold, cutParameters[ p ].maxPoolingRadius, cutParameters[ p ].minCutDistance, path.c_str() );
         }
 
         omp_set_num_threads( ( int32_t ) threads );
@@ -331,215 +2327,293 @@ namespace Stash
         std::vector< ThreadData_Cut > threadData;
         threadData.resize( threads );
 
-        uint32_t batchSize = 0xFFFFFFFF; // TODO: Since we're not writing to file after each batch, we need to have a single batch.
+        CutGeometry geometry;
+        geometry.window = windowParameters;
+        geometry.windowSize = windowParameters.GetWindowSize( m_spacedSeedLength );
 
-        uint32_t chunkSize = 10000;
-        uint32_t windowSize = windowParameters.GetWindowSize( m_spacedSeedLength );
-        uint32_t shift = windowSize + windowParameters.delta / 2;
-        uint32_t distance = windowSize + windowParameters.delta;
-        uint64_t minContigLength = ( uint64_t ) ( distance + windowSize + 2 * cutParameters.maxPoolingRadius );
-        uint32_t lastValidHashOffset = 2 * windowParameters.stride * ( windowParameters.numberOfFrames - 1 ) + windowParameters.delta;
-        uint32_t copySize = lastValidHashOffset * Consts::SPACED_SEED_COUNT * sizeof( uint64_t );
+        uint32_t maxDelta = windowParameters.GetMaxDelta();
+        geometry.shift = geometry.windowSize + maxDelta / 2;
+        geometry.distance = geometry.windowSize + maxDelta;
+        for ( uint32_t delta : windowParameters.deltas )
+        {
+            geometry.distances.push_back( geometry.windowSize + delta );
+            geometry.offsets.push_back( maxDelta / 2 - delta / 2 );
+        }
+
+        // Sequences are cut for each set of parameters that accepts their length.
+        std::vector< uint64_t > minContigLengths;
+        for ( const CutParameters& parameters : cutParameters )
+            minContigLengths.push_back( ( uint64_t ) ( geometry.distance + geometry.windowSize + 2 * parameters.maxPoolingRadius ) );
+
+        geometry.minContigLength = *std::min_element( minContigLengths.begin(), minContigLengths.end() );
+        // The second window of the last position ends at its last frame, so the spaced seed length is included.
+        geometry.lastValidHashOffset = geometry.distance + windowParameters.stride * ( windowParameters.numberOfFrames - 1 );
+        geometry.chunkSize = std::max< uint32_t >( 10000, 2 * geometry.lastValidHashOffset );
+        geometry.coarseStep = options.coarseStep;
 
 	// Set up intermediate memory for each thread.
         for ( uint32_t i = 0; i < threads; i++ )
         {
-            ThreadData_Cut& data = threadData[ i ];
-            data.frames = new uint64_t[ Consts::SPACED_SEED_COUNT * chunkSize ];
-            data.copySource = data.frames + ( chunkSize - lastValidHashOffset ) * Consts::SPACED_SEED_COUNT;
+            threadData[ i ].frames = new uint64_t[ Consts::SPACED_SEED_COUNT * geometry.chunkSize ];
+
+            if ( geometry.coarseStep > 1 )
+            {
+                threadData[ i ].loaded.resize( geometry.chunkSize );
+                threadData[ i ].values.resize( geometry.chunkSize );
+                threadData[ i ].computed.resize( geometry.chunkSize );
+                threadData[ i ].needed.resize( geometry.chunkSize + 1 );
+            }
         }
 
         std::vector< std::unique_ptr< Sequence > > sequences;
+        std::vector< CutSegment > segments;
+        std::vector< size_t > firstSegment;
+        std::vector< std::vector< uint8_t > > signals;
+        std::vector< uint8_t > cachedSignals;
+        std::atomic< uint64_t > cacheHits{ 0 };
+        std::atomic< uint64_t > cacheMisses{ 0 };
+        std::atomic< uint64_t > signalPositions{ 0 };
+        std::atomic< uint64_t > evaluatedPositions{ 0 };
+
+        TaskScheduler scheduler{ threads };
+
+	// Sequences are written in input order, as soon as all of their segments are done.
+        ReorderBuffer reorderBuffer{ [ & ]( size_t i )
+        {
+            const Sequence& sequence = *sequences[ i ];
+
+		// Stitch the segments and perform cutting over the matches signal.
+            for ( size_t p = 0; p < parameterSets; p++ )
+            {
+                CutChain chain{ cutParameters[ p ] };
+                if ( sequence.m_length >= minContigLengths[ p ] )
+                {
+                    for ( size_t s = firstSegment[ i ]; s < firstSegment[ i + 1 ]; s++ )
+                    {
+                        MaxPooling& pooling = segments[ s ].poolings[ p ];
+                        for ( const LowRun& run : pooling.getRuns() )
+                            chain.add( run, pooling.getLowValues().data() + run.firstValue );
+                    }
+                }
+                chain.finish();
+
+		// Chains of restricted signals end at the regions, so only cuts inside of them are kept.
+                std::vector< Breakpoint > breakpoints = chain.getBreakpoints();
+                if ( restricted && !breakpoints.empty() )
+                {
+                    auto found = regions.find( sequence.m_id );
+                    if ( found == regions.end() )
+                        breakpoints.clear();
+                    else
+                    {
+                        breakpoints.erase( std::remove_if( breakpoints.begin(), breakpoints.end(), [ & ]( const Breakpoint& breakpoint )
+                        {
+                            return !isInRegions( found->second, ( breakpoint.chainStart + breakpoint.chainEnd ) / 2 + geometry.shift );
+                        } ), breakpoints.end() );
+                    }
+                }
+
+                if ( fasta )
+                    writeCutSequence( outputs[ p ], sequence, breakpoints, geometry.shift );
+                else
+                    writeBreakpoints( breakpointOutputs[ p ], options.format, sequence, breakpoints, geometry.shift );
+            }
+
+            if ( signalTrack && !signals[ i ].empty() )
+            {
+                signalTrack->write( sequence.m_id, geometry.shift, signals[ i ] );
+                std::vector< uint8_t >().swap( signals[ i ] );
+            }
+        } };
 
         uint32_t totalSequencesProcessed = 0;
 
         while ( true )
         {
-	    // Read sequences in batches.
-            uint32_t readCount = reader.loadSequences( batchSize, sequences );
+	    // Read sequences in batches of bounded size.
+            uint32_t readCount = reader.loadSequences( 0xFFFFFFFF, sequences, 0, options.bufferBases );
+            if ( readCount == 0 )
+                break;
 
-	    // Schedule the batch between threads.
-            int sequencesCount = ( int64_t ) sequences.size();
-#pragma omp parallel for schedule( dynamic )
-            for ( int64_t i = 0; i < sequencesCount; ++i )
+	    // Split long sequences into overlapping segments, so a single contig can use several threads.
+            segments.clear();
+            firstSegment.resize( sequences.size() + 1 );
+            for ( size_t i = 0; i < sequences.size(); i++ )
             {
-                Sequence* sequence = sequences[ i ].get();
-
-                ThreadData_Cut& threadExclusiveData = threadData[ omp_get_thread_num() ];
+                firstSegment[ i ] = segments.size();
 
 		// Ignore short sequences.
-                if ( sequence->m_length < minContigLength )
+                uint64_t length = sequences[ i ]->m_length;
+                if ( length < geometry.minContigLength )
+                    continue;
+
+                uint64_t matchesLength = length - m_spacedSeedLength + 1 - geometry.lastValidHashOffset;
+                if ( !restricted )
                 {
-                    threadExclusiveData.outputAssembly.emplace_back( sequence->m_id, sequence->m_sequence, sequence->m_length );
+                    for ( uint64_t begin = 0; begin < matchesLength; begin += Consts::CUT_SEGMENT_LENGTH )
+                        segments.emplace_back( i, cutParameters, matchesLength, begin, std::min( begin + Consts::CUT_SEGMENT_LENGTH, matchesLength ) );
                     continue;
                 }
 
-                uint64_t* frames = threadExclusiveData.frames;
-
-                uint64_t maxHashes = sequence->m_length - m_spacedSeedLength + 1;
-                uint64_t matchesLength = maxHashes - lastValidHashOffset;
-
-                uint8_t* signal = new uint8_t[ matchesLength ];
-
-                uint64_t hashCounter = 0;
-                uint64_t currentBatchCounter = 0;
-                uint8_t matchSet[ 16 * 16 ];
+		// Signal position p is cut at contig position p + shift. Segments pool and hash their own flanks.
+                auto found = regions.find( sequences[ i ]->m_id );
+                if ( found == regions.end() )
+                    continue;
 
-		// Generate the matches signal.
-                btllib::SeedNtHash nt{ sequence->m_sequence, sequence->m_length, m_ntSeeds, 1, m_spacedSeedLength };
-                while ( 1 ){
-                    while ( hashCounter < maxHashes && currentBatchCounter < chunkSize ){
-                        if ( nt.roll() )
-                        {
-                            uint64_t index = currentBatchCounter << 2;
-                            for ( int i = 0; i < 4; i++ )
-                                frames[ index++ ] = m_memory[ nt.hashes()[ i ] & m_lastRow ];
-                        }
-                        currentBatchCounter++;
-                        hashCounter++;
-                    }
+                for ( const std::pair< uint64_t, uint64_t >& region : found->second )
+                {
+                    uint64_t regionBegin = region.first > geometry.shift ? region.first - geometry.shift : 0;
+                    uint64_t regionEnd = std::min( matchesLength, region.second > geometry.shift ? region.second - geometry.shift : 0 );
+                    for ( uint64_t begin = regionBegin; begin < regionEnd; begin += Consts::CUT_SEGMENT_LENGTH )
+                        segments.emplace_back( i, cutParameters, matchesLength, begin, std::min( begin + Consts::CUT_SEGMENT_LENGTH, regionEnd ) );
+                }
+            }
+            firstSegment[ sequences.size() ] = segments.size();
 
-                    for ( uint64_t position = hashCounter - currentBatchCounter; position < hashCounter - lastValidHashOffset; position++ ){
-                        // Count number of matches between two windows.
-			int maxMatches = 0;
-                        uint64_t frameIndex = position - ( hashCounter - currentBatchCounter );
-                        uint64_t lastFrame1 = frameIndex + windowParameters.numberOfFrames * windowParameters.stride;
-                        uint64_t lastFrame2 = lastFrame1 + distance;
-                        for ( uint64_t index1 = frameIndex; index1 < lastFrame1; index1 += windowParameters.stride ){
-                            for ( uint64_t index2 = frameIndex + distance; index2 < lastFrame2; index2 += windowParameters.stride ){
-                                memset( matchSet, 0x0, 256 );
-                                for ( int row = 0; row < 4; ){
-                                    uint64_t frame = frames[ ( index1 << 2 ) + row++ ];
-
-                                    matchSet[ ( ( frame & 15 ) << 4 ) ] = 1;
-
-                                    for ( int column = 1; column < 15; ){
-                                        matchSet[ ( frame & 240 ) + column++ ] = 1;
-                                        frame >>= 4;
-                                    }
-
-                                    matchSet[ ( frame & 240 ) + 15 ] = 1;
-                                }
-
-                                memset( matchSet, 0x0, 16 );
-
-                                int matches = 0;
-                                for ( int row = 0; row < 4; )
-                                {
-                                    uint64_t frame = frames[ ( index2 << 2 ) + row++ ];
-
-                                    int pair = ( frame & 15 ) << 4;
-                                    matches += matchSet[ pair ];
-                                    matchSet[ pair ] = 0;
-
-                                    for ( int column = 1; column < 15; )
-                                    {
-                                        pair = ( frame & 240 ) + column++;
-                                        matches += matchSet[ pair ];
-                                        matchSet[ pair ] = 0;
-                                        frame >>= 4;
-                                    }
-
-                                    pair = ( frame & 240 ) + 15;
-                                    matches += matchSet[ pair ];
-                                    matchSet[ pair ] = 0;
-                                }
-
-                                if ( matches > maxMatches )
-                                    maxMatches = matches;
-                            }
-                        }
-
-                        signal[ position ] = maxMatches;
-                    }
+            std::vector< std::atomic< size_t > > remainingSegments( sequences.size() );
+            for ( size_t i = 0; i < sequences.size(); i++ )
+                remainingSegments[ i ] = firstSegment[ i + 1 ] - firstSegment[ i ];
 
-                    if ( hashCounter == maxHashes )
-                        break;
+            signals.clear();
+            signals.resize( sequences.size() );
+            cachedSignals.assign( sequences.size(), 0 );
 
-                    memcpy( frames, threadExclusiveData.copySource, copySize );
-                    currentBatchCounter = lastValidHashOffset;
-                }
+	    // ntHash skips k-mers with non-ACGT bases, so such sequences are rolled once to find where each segment starts.
+            for ( size_t i = 0; i < sequences.size(); i++ )
+                scheduler.add( firstSegment[ i ] == firstSegment[ i + 1 ] ? 0 : sequences[ i ]->m_length );
 
-                uint64_t start = 0;
-                uint64_t lastCutPosition = 0;
-                uint64_t chainStart = 0;
+            scheduler.run( [ & ]( size_t i, uint32_t )
+            {
+                const Sequence& sequence = *sequences[ i ];
 
-		// Perform cutting over the matches signal.
-                for ( uint64_t position = cutParameters.maxPoolingRadius + 1; position < matchesLength - cutParameters.maxPoolingRadius - 1; position++ )
+		// Cached sequences skip the signal computation, the others compute and store their full signal.
+                if ( ( signalCache || signalTrack ) && firstSegment[ i ] != firstSegment[ i + 1 ] )
                 {
-                    uint32_t max = 0;
-                    for ( uint64_t j = position - cutParameters.maxPoolingRadius; j < position + cutParameters.maxPoolingRadius; j++ ){
-                        if ( signal[ j ] > max )
-                            max = signal[ j ];
+                    uint64_t matchesLength = sequence.m_length - m_spacedSeedLength + 1 - geometry.lastValidHashOffset;
+                    if ( signalCache && signalCache->load( sequence, matchesLength, signals[ i ] ) )
+                    {
+                        cachedSignals[ i ] = 1;
+                        cacheHits++;
+                        return;
                     }
 
-                    if ( max < cutParameters.cutThreshold ){
-                        if ( position - lastCutPosition >= cutParameters.minCutDistance || lastCutPosition == 0 ) {
-                            if ( chainStart != 0 )
-                            {
-                                uint64_t end = ( chainStart + lastCutPosition ) / 2 + shift;
+                    if ( signalCache )
+                        cacheMisses++;
+                    signals[ i ].resize( matchesLength );
+                    for ( size_t s = firstSegment[ i ]; s < firstSegment[ i + 1 ]; s++ )
+                        segments[ s ].store( signals[ i ].data() );
+                }
 
-                                sprintf( threadExclusiveData.header, "%s:%" PRIu64 "-%" PRIu64, sequence->m_id.c_str(), start, end );
-                                threadExclusiveData.outputAssembly.emplace_back( threadExclusiveData.header, sequence->m_sequence + start, end - start );
+                if ( firstSegment[ i ] == firstSegment[ i + 1 ] || isPlainSequence( sequence ) )
+                {
+                    for ( size_t s = firstSegment[ i ]; s < firstSegment[ i + 1 ]; s++ )
+                        segments[ s ].rollPosition = segments[ s ].signalBegin;
+                    return;
+                }
 
-                                start = end;
-                            }
-                            chainStart = position;
-                        }
-                        lastCutPosition = position;
+                btllib::SeedNtHash nt{ sequence.m_sequence, sequence.m_length, m_ntSeeds, 1, m_spacedSeedLength };
+                bool rolling = true;
+                uint64_t calls = 0;
+                for ( size_t s = firstSegment[ i ]; s < firstSegment[ i + 1 ]; s++ )
+                {
+                    while ( rolling && calls <= segments[ s ].signalBegin )
+                    {
+                        rolling = nt.roll();
+                        calls++;
                     }
+                    segments[ s ].rollPosition = rolling ? nt.get_pos() : s_exhaustedRoll;
                 }
+            } );
 
-		// Write the output.
-                if ( chainStart != 0 ){
-                    uint64_t end = ( chainStart + lastCutPosition ) / 2 + shift;
+	    // Short sequences are final already.
+            reorderBuffer.reset( sequences.size() );
+            for ( size_t i = 0; i < sequences.size(); i++ )
+            {
+                if ( remainingSegments[ i ] == 0 )
+                    reorderBuffer.complete( i );
+            }
 
-                    sprintf( threadExclusiveData.header, "%s:%" PRIu64 "-%" PRIu64, sequence->m_id.c_str(), start, end );
-                    threadExclusiveData.outputAssembly.emplace_back( threadExclusiveData.header, sequence->m_sequence + start, end - start );
+	    // Generate the matches signal of each segment.
+            for ( const CutSegment& segment : segments )
+                scheduler.add( segment.signalEnd - segment.signalBegin );
 
-                    start = end;
-                }
+            scheduler.run( [ & ]( size_t s, uint32_t thread )
+            {
+                CutSegment& segment = segments[ s ];
+                size_t i = segment.sequenceIndex;
 
-                if ( start )
-                    sprintf( threadExclusiveData.header, "%s:%" PRIu64 "-%" PRIu64, sequence->m_id.c_str(), start, sequence->m_length );
+                if ( cachedSignals[ i ] )
+                {
+                    for ( uint64_t position = segment.signalBegin; position < segment.signalEnd; position++ )
+                    {
+                        for ( MaxPooling& pooling : segment.poolings )
+                            pooling.push( position, signals[ i ][ position ] );
+                    }
+                }
                 else
-                    sprintf( threadExclusiveData.header, "%s", sequence->m_id.c_str() );
+                {
+                    signalPositions += segment.signalEnd - segment.signalBegin;
+                    evaluatedPositions += computeSignal( *sequences[ i ], geometry, threadData[ thread ], segment );
+                }
 
-                threadExclusiveData.outputAssembly.emplace_back( threadExclusiveData.header, sequence->m_sequence + start, sequence->m_length - start );
+                if ( --remainingSegments[ i ] == 0 )
+                {
+                    if ( signalCache && !cachedSignals[ i ] )
+                        signalCache->store( *sequences[ i ], signals[ i ] );
 
-                delete[]( signal );
-            }
+                    if ( !signalTrack )
+                        std::vector< uint8_t >().swap( signals[ i ] );
+                    reorderBuffer.complete( i );
+                }
+            } );
 
             totalSequencesProcessed += readCount;
             STASH_LOG_INFO_PARAMS( "Total Processed Sequences: %" PRId32, totalSequencesProcessed );
 
-            if ( readCount != batchSize )
-                break;
+	    // The outputs refer to the bases of the sequences until they are flushed.
+            for ( AssemblyWriter& output : outputs )
+                output.flush();
 
             sequences.clear();
         }
 
         reader.close();
 
-        bool first = true;
-        for ( auto& threadExclusiveData : threadData )
+        scheduler.report( "Cut" );
+
+        if ( signalCache )
+            STASH_LOG_INFO_PARAMS( "Signal cache: %" PRIu64 " hits, %" PRIu64 " misses.", cacheHits.load(), cacheMisses.load() );
+
+        if ( geometry.coarseStep > 1 && signalPositions > 0 )
+            STASH_LOG_INFO_PARAMS( "Coarse-to-fine: evaluated %" PRIu64 " of %" PRIu64 " signal positions (%.1f%%).",
+                evaluatedPositions.load(), signalPositions.load(), 100.0 * evaluatedPositions / signalPositions );
+
+        bool written = true;
+        uint64_t passthroughBytes = 0;
+        for ( AssemblyWriter& output : outputs )
         {
-            for ( size_t i = 0; i < threadExclusiveData.outputAssembly.size(); i++ ){
-                if ( first )
-                {
-                    first = false;
-                    outputFile << ">" << threadExclusiveData.outputAssembly[ i ].m_id.c_str() << "\n";
-                }
-                else
-                    outputFile << "\n>" << threadExclusiveData.outputAssembly[ i ].m_id.c_str() << "\n";
+            passthroughBytes += output.getPassthroughBytes();
+            written = output.close() && written;
+        }
 
-                outputFile.write( threadExclusiveData.outputAssembly[ i ].m_sequence, threadExclusiveData.outputAssembly[ i ].m_length );
-            }
+        if ( signalTrack )
+            written = signalTrack->close() && written;
+
+        for ( FILE* output : breakpointOutputs )
+        {
+            bool failed = ferror( output ) != 0;
+            written = fclose( output ) == 0 && !failed && written;
         }
 
-        outputFile << "\n";
-        outputFile.close();
+        if ( passthroughBytes > 0 )
+            STASH_LOG_INFO_PARAMS( "Passed %.1f MB of the assembly through to the output.", passthroughBytes / 1048576.0 );
 
-        return true;
+        for ( auto& threadExclusiveData : threadData )
+            delete[]( threadExclusiveData.frames );
+
+        if ( !written )
+            STASH_LOG_ERROR_PARAMS( "Failed to write output file: %s", outputPath );
+
+        return written;
     }
 }
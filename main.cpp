@@ -1,5 +1,7 @@
 #include "CLI11.hpp"
 #include "Stash/Stash.h"
+#include "Stash/FastaReader.h"
+#include "Stash/HashStream.h"
 
 int parseCommandLineArguments( int argc, char* argv[] )
 {
@@ -11,27 +13,71 @@ int parseCommandLineArguments( int argc, char* argv[] )
 	stashApp.set_version_flag( "-v,--version", "Stash Version: " STASH_VERSION, "Displays the version of Stash.");
 	stashApp.set_help_flag( "-h,--help", "Displays the help menu." );
 
-	std::string readsPath, stashPath, assemblyPath, outputPath;
-	uint32_t logRows, threads, numberOfFrames, stride, delta, cutThreshold, maxPoolingRadius, minCutDistance;
+	std::vector< std::string > readsPaths, hashStreamPaths;
+	std::string stashPath, assemblyPath, outputPath, signalCachePath, signalTrackPath, regionsPath, sharedName, readCachePath, format;
+	uint32_t logRows, threads, numberOfFrames, stride, partitions;
+	std::vector< uint32_t > deltas{ 751 };
+	std::vector< uint32_t > cutThresholds{ 11 }, maxPoolingRadii{ 1 }, minCutDistances{ 1000 };
+	uint64_t bufferSize;
+	uint32_t coarseStep, signalBinSize;
+	bool mapped = false, prefault = false, sparse = false, directIO = false, skipVerify = false, verify = false, index = false, signalBinMean = false;
+	int compressionLevel;
 
 	auto stashFillArguments = stashApp.add_subcommand( "fill", "Creates and fills a Stash using the input reads." );
-	stashFillArguments->add_option( "-r,--reads", readsPath, "Input Reads (fasta)" )->required();
+	stashFillArguments->add_option( "-r,--reads", readsPaths, "Input Reads (fasta/fastq, - for stdin), read concurrently if several" );
+	stashFillArguments->add_option( "--hashes", hashStreamPaths, "Input Hash Streams (- for stdin), as Written by hash" );
 	stashFillArguments->add_option( "-o,--output", outputPath, "Output Path" )->required();
 	stashFillArguments->add_option( "-l,--log_rows", logRows, "Log2 of Number of Rows" )->default_val( 30 );
+	stashFillArguments->add_option( "-c,--compression_level", compressionLevel, "zstd Level of the Saved Stash (0 Saves It Raw)" )->default_val( 0 );
+	stashFillArguments->add_flag( "--sparse", sparse, "Save Only the Used Rows of the Stash" );
+	stashFillArguments->add_flag( "--direct_io", directIO, "Write the Stash with O_DIRECT" );
+	stashFillArguments->add_flag( "--prefault", prefault, "Touch Every Page of the Stash on All Threads Before Filling" );
+	stashFillArguments->add_option( "-p,--partitions", partitions, "Fill the Stash in This Many Passes to Bound Its Memory" )->default_val( 1 );
+	stashFillArguments->add_option( "--read_cache", readCachePath, "File That Keeps the Hashed Reads Between Passes" );
 	stashFillArguments->add_option( "-t,--threads", threads, "Number of Threads" )->default_val( 8 );
 
+	auto stashHashArguments = stashApp.add_subcommand( "hash", "Writes the hashed reads as a stream that fill inserts without hashing." );
+	stashHashArguments->add_option( "-r,--reads", readsPaths, "Input Reads (fasta/fastq, - for stdin), hashed one after another if several" )->required();
+	stashHashArguments->add_option( "-o,--output", outputPath, "Output Path (- for stdout)" )->required();
+	stashHashArguments->add_option( "-t,--threads", threads, "Number of Parsing Threads" )->default_val( 8 );
+
 	auto stashCutArguments = stashApp.add_subcommand( "cut", "Detects and cuts the misassembled contigs of the input assembly." );
 	stashCutArguments->add_option( "-a,--assembly", assemblyPath, "Input Assembly (fasta)" )->required();
-	stashCutArguments->add_option( "-s,--stash", stashPath, "Stash Path" )->required();
+	stashCutArguments->add_option( "-s,--stash", stashPath, "Stash Path" );
+	stashCutArguments->add_option( "--shm", sharedName, "Attach to a Stash Pinned in Shared Memory Instead" );
 	stashCutArguments->add_option( "-o,--output", outputPath, "Output Path" )->required();
 	stashCutArguments->add_option( "-n,--number_of_frames", numberOfFrames, "Number of Frames" )->group( "Stash Window" )->default_val( 1 );
 	stashCutArguments->add_option( "-r,--stride", stride, "Stride" )->group( "Stash Window" )->default_val( 13 );
-	stashCutArguments->add_option( "-l,--delta", delta, "Delta" )->group( "Stash Window" )->default_val( 751 );
-	stashCutArguments->add_option( "-x,--threshold", cutThreshold, "Cut Threshold" )->group( "Cut Parameters" )->default_val( 11 );
-	stashCutArguments->add_option( "-m,--max_pooling_radius", maxPoolingRadius, "Max Pooling Radius" )->group( "Cut Parameters" )->default_val( 1 );
-	stashCutArguments->add_option( "-d,--min_cut_distance", minCutDistance, "Min Cut Distance" )->group( "Cut Parameters" )->default_val( 1000 );
+	stashCutArguments->add_option( "-l,--delta", deltas, "Delta" )->group( "Stash Window" )->delimiter( ',' )->capture_default_str();
+	stashCutArguments->add_option( "-x,--threshold", cutThresholds, "Cut Threshold" )->group( "Cut Parameters" )->delimiter( ',' )->capture_default_str();
+	stashCutArguments->add_option( "-m,--max_pooling_radius", maxPoolingRadii, "Max Pooling Radius" )->group( "Cut Parameters" )->delimiter( ',' )->capture_default_str();
+	stashCutArguments->add_option( "-d,--min_cut_distance", minCutDistances, "Min Cut Distance" )->group( "Cut Parameters" )->delimiter( ',' )->capture_default_str();
+	stashCutArguments->add_option( "--coarse_step", coarseStep, "Coarse Signal Step (0 Evaluates Every Position)" )->default_val( 0 );
+	stashCutArguments->add_option( "--format", format, "Output Format: fasta, or only the breakpoints as bed, agp or tsv" )->check( CLI::IsMember( { "fasta", "bed", "agp", "tsv" } ) )->default_val( "fasta" );
+	stashCutArguments->add_option( "-c,--compression_level", compressionLevel, "zstd Level of the FASTA Output (0 Writes It Plain)" )->default_val( 0 );
+	stashCutArguments->add_flag( "--fai", index, "Write a .fai Index of the FASTA Output" );
+	stashCutArguments->add_option( "--regions", regionsPath, "Compute the Signal and Cut Only in the Regions of This BED File" );
+	stashCutArguments->add_option( "--signal_track", signalTrackPath, "Export the Matches Signal to <Prefix>.bedGraph and <Prefix>.sigtrack" )->group( "Signal Export" );
+	stashCutArguments->add_option( "--signal_bin", signalBinSize, "Positions per Exported Signal Value" )->group( "Signal Export" )->default_val( 1 );
+	stashCutArguments->add_flag( "--signal_mean", signalBinMean, "Export the Mean of Each Bin Instead of Its Minimum" )->group( "Signal Export" );
+	stashCutArguments->add_option( "--signal_cache", signalCachePath, "Signal Cache Directory" );
+	stashCutArguments->add_option( "-b,--buffer_size", bufferSize, "Max Assembly Bases in Memory (Mbp)" )->default_val( 1024 );
+	stashCutArguments->add_flag( "--mmap", mapped, "Map the Stash Read-Only Instead of Reading It" );
+	stashCutArguments->add_flag( "--prefault", prefault, "Touch Every Page of a Mapped Stash Before Cutting" );
+	stashCutArguments->add_flag( "--sparse", sparse, "Keep Only the Used Rows of the Stash in Memory" );
+	stashCutArguments->add_flag( "--direct_io", directIO, "Read the Stash with O_DIRECT" );
+	stashCutArguments->add_flag( "--verify", verify, "Check a Mapped or Shared Stash Against Its Checksums" );
+	stashCutArguments->add_flag( "--skip_verify", skipVerify, "Do Not Check the Stash Against Its Checksums" );
 	stashCutArguments->add_option( "-t,--threads", threads, "Number of Threads" )->default_val( 8 );
 
+	auto stashPinArguments = stashApp.add_subcommand( "pin", "Loads a Stash into named shared memory for cut runs to attach to." );
+	stashPinArguments->add_option( "-s,--stash", stashPath, "Stash Path" )->required();
+	stashPinArguments->add_option( "-n,--name", sharedName, "Shared Memory Name" )->required();
+	stashPinArguments->add_option( "-t,--threads", threads, "Number of Threads" )->default_val( 8 );
+
+	auto stashUnpinArguments = stashApp.add_subcommand( "unpin", "Removes a Stash from shared memory once no cut run is attached to it." );
+	stashUnpinArguments->add_option( "-n,--name", sharedName, "Shared Memory Name" )->required();
+
 	if ( argc == 1 )
 	{
 		std::cout << stashApp.help( "", CLI::AppFormatMode::All );
@@ -48,23 +94,172 @@ int parseCommandLineArguments( int argc, char* argv[] )
 		return returnValue;
 	}
 
+	std::vector<std::string> seeds = {
+		"10111111111111111101",
+		"11011111111111111011",
+		"11101111111111110111",
+		"11110111111111101111",
+	};
+
 	if ( stashApp.get_subcommands()[ 0 ] == stashFillArguments )
 	{
-		std::vector<std::string> seeds = {
-			"10111111111111111101",
-			"11011111111111111011",
-			"11101111111111110111",
-			"11110111111111101111",
-		};
+		if ( readsPaths.empty() && hashStreamPaths.empty() )
+		{
+			std::cout << "Fill needs reads or hash streams.\n" << stashFillArguments->help() << std::endl;
+			return -1;
+		}
 
 		Stash::Stash stash{ logRows, seeds };
-		stash.fill( readsPath.c_str(), threads );
-		stash.save( outputPath.c_str() );
+		if ( partitions > 1 )
+		{
+			if ( compressionLevel > 0 || sparse || prefault || readsPaths.size() != 1 || !hashStreamPaths.empty() )
+			{
+				std::cout << "A partitioned fill reads a single reads input, saves the Stash raw and cannot prefault it.\n" << stashFillArguments->help() << std::endl;
+				return -1;
+			}
+
+			Stash::FillOptions fillOptions;
+			fillOptions.partitions = partitions;
+			fillOptions.readCachePath = readCachePath;
+			fillOptions.directIO = directIO;
+
+			return stash.fill( readsPaths[ 0 ].c_str(), outputPath.c_str(), threads, fillOptions ) ? 0 : -1;
+		}
+
+		if ( prefault )
+			stash.prefault( threads );
+		if ( !stash.fill( readsPaths, hashStreamPaths, threads ) )
+			return -1;
+
+		Stash::SaveOptions saveOptions;
+		saveOptions.compressionLevel = compressionLevel;
+		saveOptions.sparse = sparse;
+		saveOptions.directIO = directIO;
+		saveOptions.threads = threads;
+
+		if ( !stash.save( outputPath.c_str(), saveOptions ) )
+			return -1;
+	}
+	else if ( stashApp.get_subcommands()[ 0 ] == stashHashArguments )
+	{
+		Stash::HashStreamWriter writer;
+		if ( !writer.open( outputPath.c_str(), seeds ) )
+		{
+			std::cerr << "Failed to open hash stream: " << outputPath << std::endl;
+			return -1;
+		}
+
+		for ( const std::string& readsPath : readsPaths )
+		{
+			Stash::ScopedFastaReader reader;
+			if ( !reader.open( readsPath.c_str(), threads ) )
+			{
+				std::cerr << "Failed to open reads file: " << readsPath << std::endl;
+				return -1;
+			}
+
+			std::vector< std::unique_ptr< Stash::Read > > reads;
+			while ( reader.loadReads( 20000, reads ) > 0 )
+			{
+				for ( const std::unique_ptr< Stash::Read >& read : reads )
+				{
+					if ( !writer.write( *read ) )
+					{
+						std::cerr << "Failed to write hash stream: " << outputPath << std::endl;
+						return -1;
+					}
+				}
+				reads.clear();
+			}
+		}
+
+		if ( !writer.close() )
+			return -1;
+	}
+	else if ( stashApp.get_subcommands()[ 0 ] == stashPinArguments )
+	{
+		Stash::LoadOptions loadOptions;
+		loadOptions.mapped = true;
+		loadOptions.threads = threads;
+		loadOptions.verify = Stash::Verification::Always;
+
+		Stash::Stash stash{ stashPath.c_str(), loadOptions };
+		if ( !stash.publish( sharedName.c_str(), threads ) )
+			return -1;
+	}
+	else if ( stashApp.get_subcommands()[ 0 ] == stashUnpinArguments )
+	{
+		if ( !Stash::Stash::unpublish( sharedName.c_str() ) )
+			return -1;
 	}
 	else
 	{
-		Stash::Stash stash{ stashPath.c_str() };
-		stash.cut( assemblyPath.c_str(), outputPath.c_str(), { numberOfFrames, stride, delta }, { cutThreshold, maxPoolingRadius, minCutDistance }, threads );
+		if ( stashPath.empty() == sharedName.empty() )
+		{
+			std::cout << "Cut needs exactly one of --stash and --shm.\n" << stashCutArguments->help() << std::endl;
+			return -1;
+		}
+
+		if ( format != "fasta" && ( compressionLevel > 0 || index ) )
+		{
+			std::cout << "Only a FASTA output can be compressed or indexed.\n" << stashCutArguments->help() << std::endl;
+			return -1;
+		}
+
+		if ( compressionLevel > 0 && index )
+		{
+			std::cout << "A compressed output cannot be indexed.\n" << stashCutArguments->help() << std::endl;
+			return -1;
+		}
+
+		if ( verify && skipVerify )
+		{
+			std::cout << "--verify and --skip_verify cannot be used together.\n" << stashCutArguments->help() << std::endl;
+			return -1;
+		}
+
+		if ( !regionsPath.empty() && ( !signalCachePath.empty() || !signalTrackPath.empty() ) )
+		{
+			std::cout << "The signal of a cut restricted to regions can neither be cached nor exported.\n" << stashCutArguments->help() << std::endl;
+			return -1;
+		}
+
+		Stash::CutOptions options;
+		options.bufferBases = bufferSize * 1000000;
+		options.signalCachePath = signalCachePath;
+		options.coarseStep = coarseStep;
+		options.compressionLevel = compressionLevel;
+		options.index = index;
+		options.signalTrackPath = signalTrackPath;
+		options.signalBinSize = signalBinSize;
+		options.signalBinMean = signalBinMean;
+		options.regionsPath = regionsPath;
+		if ( format == "bed" )
+			options.format = Stash::CutFormat::Bed;
+		else if ( format == "agp" )
+			options.format = Stash::CutFormat::Agp;
+		else if ( format == "tsv" )
+			options.format = Stash::CutFormat::Tsv;
+
+		// Several values for the cut parameters sweep over all of their combinations.
+		std::vector< Stash::CutParameters > cutParameters;
+		for ( uint32_t cutThreshold : cutThresholds )
+			for ( uint32_t maxPoolingRadius : maxPoolingRadii )
+				for ( uint32_t minCutDistance : minCutDistances )
+					cutParameters.push_back( { cutThreshold, maxPoolingRadius, minCutDistance } );
+
+		Stash::LoadOptions loadOptions;
+		loadOptions.mapped = mapped;
+		loadOptions.prefault = prefault;
+		loadOptions.threads = threads;
+		loadOptions.sharedMemoryName = sharedName;
+		loadOptions.sparse = sparse;
+		loadOptions.directIO = directIO;
+		loadOptions.verify = verify ? Stash::Verification::Always : skipVerify ? Stash::Verification::Never : Stash::Verification::Default;
+
+		Stash::Stash stash{ stashPath.c_str(), loadOptions };
+		if ( !stash.cut( assemblyPath.c_str(), outputPath.c_str(), { numberOfFrames, stride, deltas }, cutParameters, threads, options ) )
+			return -1;
 	}
 
 	return 0;